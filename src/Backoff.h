@@ -0,0 +1,41 @@
+#ifndef _BACKOFF_H
+#define _BACKOFF_H
+
+#include <thread>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Waiting strategy for the lock free queues: spin first, then give up the time slice
+ * and finally sleep, so an idle consumer does not burn a core forever.
+ * */
+class Backoff
+{
+public:
+	void pause()
+	{
+		if(_count < SpinLimit)
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			_mm_pause();
+#endif
+		}
+		else if(_count < YieldLimit)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		++_count;
+	}
+
+	void reset() {_count = 0;}
+
+private:
+	static constexpr int SpinLimit = 128;
+	static constexpr int YieldLimit = SpinLimit + 64;
+	int _count{0};
+};
+
+#endif
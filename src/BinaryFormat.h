@@ -0,0 +1,224 @@
+#ifndef _BINARYFORMAT_H
+#define _BINARYFORMAT_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <stdexcept>
+#include "InputReader.h"
+#include "SymbolTable.h"
+#include "Record.h"
+
+using namespace std;
+
+/*
+ * Binary capture of one feed, so a replay does not parse the CSV again:
+ * BinaryFileHeader
+ * symbol dictionary	symbolCount entries of a uint16 length and the name's bytes
+ * padding				up to recordsOffset, 8 byte aligned
+ * records				recordCount fixed width BinaryRecords
+ * Integers are in the writer's byte order - the magic does not match on a machine of the other one.
+ * */
+struct BinaryFileHeader
+{
+	static constexpr uint32_t Magic = 0x424d444d;	// "MDMB" little endian
+	static constexpr uint32_t CurrentVersion = 1;
+
+	uint32_t magic{Magic};
+	uint32_t version{CurrentVersion};
+	uint32_t recordSize;
+	uint32_t symbolCount;
+	uint64_t recordCount;
+	uint64_t recordsOffset;
+};
+
+struct BinaryRecord
+{
+	int64_t  time;		// nanos since midnight
+	int64_t  bid;		// price ticks
+	int64_t  ask;
+	uint32_t bidSize;
+	uint32_t askSize;
+	uint32_t symbol;	// index into the dictionary
+	uint32_t reserved;
+};
+
+static_assert(sizeof(BinaryFileHeader) == 32, "BinaryFileHeader layout");
+static_assert(sizeof(BinaryRecord) == 40, "BinaryRecord layout");
+
+class BinaryFileWriter
+{
+public:
+	BinaryFileWriter(const string& file, const vector<string>& symbols, uint64_t recordCount) : _out(file, ios::binary | ios::trunc)
+	{
+		if(!_out)
+			throw invalid_argument("cannot write " + file);
+		BinaryFileHeader header;
+		header.recordSize = sizeof(BinaryRecord);
+		header.symbolCount = symbols.size();
+		header.recordCount = recordCount;
+		uint64_t offset = sizeof(header);
+		for(const string& symbol : symbols)
+		{
+			if(symbol.size() > numeric_limits<uint16_t>::max())
+				throw invalid_argument("symbol too long: " + symbol);
+			offset += sizeof(uint16_t) + symbol.size();
+		}
+		header.recordsOffset = (offset + 7) & ~uint64_t(7);
+
+		_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		for(const string& symbol : symbols)
+		{
+			uint16_t length = symbol.size();
+			_out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+			_out.write(symbol.data(), symbol.size());
+		}
+		static const char padding[8] = {0};
+		_out.write(padding, header.recordsOffset - offset);
+	}
+
+	void write(const BinaryRecord& rec) {_out.write(reinterpret_cast<const char*>(&rec), sizeof(rec));}
+
+	bool close()
+	{
+		_out.close();
+		return !_out.fail();
+	}
+
+private:
+	ofstream _out;
+};
+
+/*
+ * Converts a CSV capture in two passes, the first one only collects the dictionary and counts the
+ * records. Lines which do not parse are dropped, the same way a Feed drops them. Returns the
+ * number of records written.
+ * */
+inline uint64_t convertCsvToBinary(const string& csvFile, const string& binaryFile)
+{
+	vector<string> symbols;
+	vector<uint32_t> indexOf;		// by SymbolID
+	uint64_t recordCount = 0;
+	SymbolCache cache;
+	Tokenizer tokenizer(',');
+	auto forEachRecord = [&](const function<void(const Record&)>& f) {
+		MmapFileInputReader input(csvFile);
+		if(!input.isValid())
+			throw invalid_argument("cannot read " + csvFile);
+		string_view line;
+		while(input.readLineView(line))
+		{
+			try
+			{
+				f(Record(line, tokenizer, cache, 0, 0));
+			}
+			catch(const Record::RecordInvalid&)
+			{
+			}
+		}
+	};
+
+	forEachRecord([&](const Record& rec) {
+		if(rec.Symbolid() >= indexOf.size())
+			indexOf.resize(rec.Symbolid()+1, numeric_limits<uint32_t>::max());
+		if(indexOf[rec.Symbolid()] == numeric_limits<uint32_t>::max())
+		{
+			indexOf[rec.Symbolid()] = symbols.size();
+			symbols.push_back(rec.Symbol());
+		}
+		++recordCount;
+	});
+
+	BinaryFileWriter writer(binaryFile, symbols, recordCount);
+	forEachRecord([&](const Record& rec) {
+		BinaryRecord out{rec.Time().nanos(), rec.Bid(), rec.Ask(), rec.BidSize(), rec.AskSize(), indexOf[rec.Symbolid()], 0};
+		writer.write(out);
+	});
+	if(!writer.close())
+		throw runtime_error("writing " + binaryFile + " failed");
+	return recordCount;
+}
+
+#ifdef __unix__
+/*
+ * Maps a binary capture and hands out its records in place, nothing is parsed per record.
+ * The dictionary is interned once when the file is opened, a record's symbol is then an
+ * array lookup. A file with a wrong magic, version or record size reads as empty.
+ * */
+class BinaryFileInputReader : public InputReader
+{
+public:
+	BinaryFileInputReader(const string& inputFile, size_t readAheadWindow = 16*1024*1024) : _file(inputFile, readAheadWindow)
+	{
+		_valid = _open();
+		if(!_valid)
+			cerr << "warning: " << inputFile << " is not a binary capture\n";
+	}
+
+	bool isBinary() {return true;}
+
+	bool readBinaryRecord(const BinaryRecord*& rec, SymbolID& symbol)
+	{
+		if(_next >= _count)
+		{
+			_valid = false;
+			return false;
+		}
+		size_t pos = _offset + _next * sizeof(BinaryRecord);
+		rec = reinterpret_cast<const BinaryRecord*>(_file.data() + pos);
+		_file.consumedUpTo(pos);
+		++_next;
+		++_entriesRead;
+		if(rec->symbol >= _symbols.size())
+			return false;
+		symbol = _symbols[rec->symbol];
+		return true;
+	}
+
+	// there are no lines
+	bool readLine(string&)
+	{
+		_valid = false;
+		return false;
+	}
+
+private:
+	bool _open()
+	{
+		if(!_file.isMapped() || _file.size() < sizeof(BinaryFileHeader))
+			return false;
+		const BinaryFileHeader& header = *reinterpret_cast<const BinaryFileHeader*>(_file.data());
+		if(header.magic != BinaryFileHeader::Magic || header.version != BinaryFileHeader::CurrentVersion ||
+		   header.recordSize != sizeof(BinaryRecord) || header.recordsOffset % 8 != 0 || header.recordsOffset > _file.size())
+			return false;
+
+		size_t pos = sizeof(BinaryFileHeader);
+		for(uint32_t i=0;i<header.symbolCount;i++)
+		{
+			uint16_t length;
+			if(pos + sizeof(length) > header.recordsOffset)
+				return false;
+			memcpy(&length, _file.data() + pos, sizeof(length));
+			pos += sizeof(length);
+			if(pos + length > header.recordsOffset)
+				return false;
+			_symbols.push_back(SymbolTable::instance().intern(string_view(_file.data() + pos, length)));
+			pos += length;
+		}
+		_offset = header.recordsOffset;
+		// a truncated file gives the records it has
+		_count = std::min<uint64_t>(header.recordCount, (_file.size() - _offset) / sizeof(BinaryRecord));
+		return true;
+	}
+
+private:
+	MappedFile		 _file;
+	vector<SymbolID> _symbols;	// by dictionary index
+	size_t			 _offset{0};
+	uint64_t		 _count{0};
+	uint64_t		 _next{0};
+};
+#endif
+
+#endif
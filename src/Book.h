@@ -3,6 +3,8 @@
 
 #include "CommonDefs.h"
 #include "Record.h"
+#include "FeedMask.h"
+#include "Histogram.h"
 #include <utility>
 #include <cassert>
 #include <unordered_map>
@@ -13,18 +15,17 @@ using namespace std;
 class Side
 {
 public:
-	Side() : _price(0.0), _qty(0) {}
-	Side(double price, unsigned int qty) : _price(price), _qty(qty) {}
-	~Side() {}
-	double price() const {return _price;}
+	Side() : _price(0), _qty(0) {}
+	Side(Price price, unsigned int qty) : _price(price), _qty(qty) {}
+	Price price() const {return _price;}
 	unsigned int qty() const {return _qty;}
-	void update(double price, unsigned int qty)
+	void update(Price price, unsigned int qty)
 	{
 		_price = price;
 		_qty = qty;
 	}
 private:
-	double 	  			 _price;
+	Price 	  			 _price;
 	unsigned int	   	  _qty;
 };
 
@@ -51,45 +52,143 @@ enum SideEnum
 };
 
 
+struct HigherPrice
+{
+	inline bool operator()(Price a, Price b) const {return a > b;}
+};
+
+struct LowerPrice
+{
+	inline bool operator()(Price a, Price b) const {return a < b;}
+};
 
-class Book
+// a power of two
+constexpr size_t quoteTreeLeaves(size_t feeds) {return feeds <= 1 ? 1 : 2 * quoteTreeLeaves((feeds+1) / 2);}
+
+/*
+ * One side of a symbol's quotes, a leaf per feed, under a tournament tree: every inner node holds
+ * the best price below it with the summed quantity and the number of feeds quoting it.
+ * Setting a quote only writes the leaf and marks it, refresh() recomputes the marked leaves'
+ * ancestors a level at a time, each of them once - at most O(log feeds) per quote set since the
+ * last refresh. The root is the smallest subtree covering the feeds seen so far, two feeds make
+ * a tree of one level. Without MDM_MAX_FEEDS the tree grows with the feeds: a feed past the leaves
+ * moves the tree into the leftmost subtree of one with enough leaves.
+ * */
+template<class Better>
+class BestQuoteTree
 {
 public:
-	Book(const string& symbol, const FeedID& feedID) : _symbol(symbol), _feedID(feedID){}
-	~Book() {}
-	//accessors
-	inline const string& Symbol() const {return _symbol;}
-	inline const TimePoint& LastUpdateTime() const {return _lastUpdate;}
-	inline const Side& bid() const {return _bid;}
-	inline const Side& ask() const {return _ask;}
-
-	void update(const Record& record)
+	struct Node
+	{
+		Price	 price;
+		unsigned qty;
+		unsigned feeds;		// 0 for a feed which did not quote yet
+	};
+
+#ifdef MDM_MAX_FEEDS
+	static constexpr size_t Leaves = quoteTreeLeaves(MaxFeeds);
+#else
+	static constexpr size_t Leaves = 1;		// to start with
+#endif
+
+	BestQuoteTree()
 	{
-		assert(record.Feedid()==_feedID);
-		_lastUpdate = record.Time();
-		_bid.update(record.Bid(), record.BidSize());
-		_ask.update(record.Ask(), record.AskSize());
+		for(Node& node : _nodes)
+			node = Node{0, 0, 0};
 	}
 
-	string toString() const
+	inline void set(FeedID feedid, Price price, unsigned qty)
 	{
-		stringstream ss;
-		ss << LastUpdateTime().toString() << "," << Symbol() << "," << _bid.price() << "," << _bid.qty() << "," << _ask.price() << "," << _ask.qty();
-		return ss.str();
+#ifndef MDM_MAX_FEEDS
+		if(size_t(feedid) >= _leaves)
+			_grow(feedid + 1);
+#endif
+		_nodes[_leaves + feedid] = Node{price, qty, 1};
+		_dirty.set(feedid);
+		while(size_t(feedid) >= _span)
+		{
+			// the new root's right half has no quotes but the dirty one, which refresh() adds
+			_nodes[_root >> 1] = _combine(_nodes[_root], _nodes[_root ^ 1]);
+			_span <<= 1;
+			_root >>= 1;
+		}
+	}
+
+	// a feed which did not quote yet may be past the leaves
+	inline const Node& quote(FeedID feedid) const
+	{
+		static const Node none{0, 0, 0};
+		return size_t(feedid) < _leaves ? _nodes[_leaves + feedid] : none;
+	}
+
+	const Node& refresh()
+	{
+		// nodes to recompute as offsets into their level, which starts at node first
+		FeedMask level = _dirty;
+		for(size_t first = _leaves;first > _root;first >>= 1)
+		{
+			FeedMask parents;
+			size_t parentFirst = first >> 1;
+			level.forEach([&](size_t offset){
+				size_t parent = offset >> 1;
+				if(parents.test(parent))
+					return;
+				parents.set(parent);
+				_nodes[parentFirst + parent] = _combine(_nodes[first + 2*parent], _nodes[first + 2*parent + 1]);
+			});
+			level = parents;
+		}
+		_dirty.clear();
+		return _nodes[_root];
 	}
 
 private:
-	string 	  _symbol;
-	FeedID	  _feedID;
-	TimePoint _lastUpdate;
-	Side	  _bid;
-	Side	  _ask;
-};
+	static inline Node _combine(const Node& a, const Node& b)
+	{
+		if(b.feeds == 0)
+			return a;
+		if(a.feeds == 0)
+			return b;
+		if(Better()(a.price, b.price))
+			return a;
+		if(Better()(b.price, a.price))
+			return b;
+		return Node{a.price, a.qty + b.qty, a.feeds + b.feeds};
+	}
 
+#ifndef MDM_MAX_FEEDS
+	// every level keeps its nodes, each now the first of its level under the new root
+	void _grow(size_t feeds)
+	{
+		size_t leaves = quoteTreeLeaves(feeds);
+		size_t shift = leaves / _leaves;
+		std::vector<Node> nodes(2*leaves, Node{0, 0, 0});
+		for(size_t first = 1;first <= _leaves;first <<= 1)
+			std::copy(_nodes.begin() + first, _nodes.begin() + 2*first, nodes.begin() + shift*first);
+		_nodes.swap(nodes);
+		_root *= shift;
+		_leaves = leaves;
+	}
+#endif
 
-typedef std::shared_ptr<Book> BookPtr;
+private:
+	FeedMask		 _dirty;			// leaves set since the last refresh
+	size_t			 _span{1};			// feeds under the root
+	size_t			 _leaves{Leaves};
+	size_t			 _root{Leaves};		// the leaves start at _leaves, 1 covers them all
+#ifdef MDM_MAX_FEEDS
+	alignas(64) Node _nodes[2*Leaves];
+#else
+	std::vector<Node> _nodes = std::vector<Node>(2*Leaves);
+#endif
+};
 
 
+/*
+ * The best price on each side over all feeds, with its summed quantity and the number of feeds
+ * quoting it. A quote is folded into the best in O(1) unless it takes the last feed away from the
+ * best price, only then the tree is refreshed - O(log feeds) per quote set since the last time.
+ * */
 class TopLevel
 {
 public:
@@ -98,151 +197,92 @@ public:
 	const Side& Bid() const {return _totalBid;}
 	const Side& Ask() const {return _totalAsk;}
 
-	unsigned int BidCount() const {return _bids.size();}
-	unsigned int AskCount() const {return _asks.size();}
+	unsigned int BidCount() const {return _bidFeeds;}
+	unsigned int AskCount() const {return _askFeeds;}
 
-	void add(const FeedID& feedid, const Side& side, SideEnum s)
+	bool feedInvolved(FeedID feedid, SideEnum s) const
 	{
-		switch(s)
-		{
-		case SideEnum::Bid:
-			_bids[feedid] = side;
-			_removeStaleBids(side.price());
-			_calcBid();
-			break;
-		case SideEnum::Ask:
-			_asks[feedid] = side;
-			_removeStaleAsks(side.price());
-			_calcAsk();
-			break;
-		}
+		if(s == SideEnum::Bid)
+			return _bidFeeds > 0 && _bids.quote(feedid).feeds > 0 && _bids.quote(feedid).price == _totalBid.price();
+		return _askFeeds > 0 && _asks.quote(feedid).feeds > 0 && _asks.quote(feedid).price == _totalAsk.price();
 	}
 
-	void remove(const FeedID& feedid, SideEnum s)
+	void update(FeedID feedid, const Side& quote, SideEnum s)
 	{
-		switch(s)
-		{
-		case SideEnum::Bid:
-			_bids.erase(feedid);
-			_calcBid();
-			break;
-		case SideEnum::Ask:
-			_asks.erase(feedid);
-			_calcAsk();
-			break;
-		}
+		if(s == SideEnum::Bid)
+			_update(feedid, quote, _bids, _totalBid, _bidFeeds);
+		else
+			_update(feedid, quote, _asks, _totalAsk, _askFeeds);
 	}
 
-
-	bool feedInvolved(FeedID feedid, SideEnum s)
+	// the feed's last quote on a side, Side(0,0) if it never quoted
+	Side quote(FeedID feedid, SideEnum s) const
 	{
-		bool res = false;
-		switch(s)
-		{
-		case SideEnum::Bid:
-			if(_bids.find(feedid)!=_bids.end())
-				res = true;
-			break;
-		case SideEnum::Ask:
-			if(_asks.find(feedid)!=_asks.end())
-				res = true;
-			break;
-		}
-		return res;
+		if(s == SideEnum::Bid)
+			return Side(_bids.quote(feedid).price, _bids.quote(feedid).qty);
+		return Side(_asks.quote(feedid).price, _asks.quote(feedid).qty);
 	}
 
 private:
-	// to maintain the invariant
-	void _removeStaleBids(double bestPrice)
+	template<class Better>
+	static void _update(FeedID feedid, const Side& quote, BestQuoteTree<Better>& tree, Side& total, unsigned& feeds)
 	{
-		vector<FeedID> staleIDs;
-		for(auto& p : _bids)
+		typename BestQuoteTree<Better>::Node old = tree.quote(feedid);
+		tree.set(feedid, quote.price(), quote.qty());
+		Better better;
+		Price price = quote.price();
+		bool wasBest = feeds > 0 && old.feeds > 0 && old.price == total.price();
+		if(feeds == 0 || better(price, total.price()))
 		{
-			if(p.second.price() < bestPrice)
-				staleIDs.push_back(p.first);
+			total = quote;
+			feeds = 1;
 		}
-		for(FeedID& id : staleIDs)
-			_bids.erase(id);
-	}
-
-	void _removeStaleAsks(double bestPrice)
-	{
-		vector<FeedID> staleIDs;
-		for(auto& p : _asks)
+		else if(price == total.price())
 		{
-			if(p.second.price() > bestPrice)
-				staleIDs.push_back(p.first);
-		}
-		for(FeedID& id : staleIDs)
-			_asks.erase(id);
-	}
-
-
-
-	void _calcBid()
-	{
-		if(_bids.size()>0)
-		{
-			unsigned int qty = 0;
-			double price = _bids.begin()->second.price();
-			for(const auto& p : _bids)
+			if(wasBest)
+				total.update(price, total.qty() - old.qty + quote.qty());
+			else
 			{
-				assert(p.second.price() == price);
-				price = p.second.price();
-				qty += p.second.qty();
+				total.update(price, total.qty() + quote.qty());
+				++feeds;
 			}
-			_totalBid = Side(price, qty);
 		}
-		else
+		else if(wasBest)
 		{
-			_totalBid = Side(0.0, 0);
-		}
-
-	}
-
-	void _calcAsk()
-	{
-		if(_asks.size()>0)
-		{
-			unsigned int qty = 0;
-			double price = _asks.begin()->second.price();
-			for(const auto& p : _asks)
+			if(--feeds == 0)
 			{
-				assert(p.second.price() == price);
-				price = p.second.price();
-				qty += p.second.qty();
+				const typename BestQuoteTree<Better>::Node& best = tree.refresh();
+				total = Side(best.price, best.qty);
+				feeds = best.feeds;
 			}
-			_totalAsk = Side(price, qty);
-		}
-		else
-		{
-			_totalAsk = Side(0.0,0);
+			else
+				total.update(total.price(), total.qty() - old.qty);
 		}
 	}
 
-
 private:
-	Side _totalBid;
-	Side _totalAsk;
-	unordered_map<FeedID, Side> _bids;
-	unordered_map<FeedID, Side> _asks;
+	Side					   _totalBid;
+	Side					   _totalAsk;
+	unsigned				   _bidFeeds{0};
+	unsigned				   _askFeeds{0};
+	BestQuoteTree<HigherPrice> _bids;
+	BestQuoteTree<LowerPrice>  _asks;
 };
 
-
 class BookStatistics
 {
 public:
 	BookStatistics() {}
-	BookStatistics(const string& symbol) : _symbol(symbol) {}
+	BookStatistics(SymbolID symbol) : _symbol(symbol) {}
 
-	void updateTopLevelChangeLatency(const chrono::high_resolution_clock::time_point& receiveTime)
+	void updateTopLevelChangeLatency(TscClock::Ticks readTicks)
 	{
 		increaseUpdateCount();
-		unsigned latency = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - receiveTime).count();
+		unsigned latency = TscClock::nanosBetween(readTicks, TscClock::now()) / 1000;
 		updateLatencyAverage(latency);
 	}
 
-	bool trySetBid(double p)
+	bool trySetBid(Price p)
 	{
 		if(p < _minBid){
 			_minBid = p;
@@ -252,7 +292,7 @@ public:
 			return false;
 	}
 
-	bool trySetAsk(double p)
+	bool trySetAsk(Price p)
 	{
 		if(p > _maxAsk){
 			_maxAsk = p;
@@ -263,51 +303,32 @@ public:
 	}
 
 
-	const string& Symbol() const {return _symbol;}
-	double MinBid() const {return _minBid;}
-	double MaxAsk() const {return _maxAsk;}
+	SymbolID Symbolid() const {return _symbol;}
+	const string& Symbol() const {return SymbolTable::instance().name(_symbol);}
+	Price MinBid() const {return _minBid;}
+	Price MaxAsk() const {return _maxAsk;}
 	unsigned int UpdateCount() const {return _updateCount;}
+	// every record of the symbol, whether it changed the top or not
+	unsigned int MessageCount() const {return _messageCount;}
+	void increaseMessageCount() {++_messageCount;}
 	//microsec
 	double		AvgUpdateTopBookLatency() const {return _avgUpdateLatency;}
 
-	void sortLatencies()
-	{
-		std::sort(_latencies.begin(), _latencies.end(), std::less<unsigned>());
-	}
-
-	unsigned MinLatency() const
-	{
-		if(_latencies.size() > 0)
-			return _latencies[0];
-		else
-			return 0;
-	}
-
-	unsigned MaxLatency() const
-	{
-		if(_latencies.size() > 0)
-			return _latencies[_latencies.size()-1];
-		else
-			return 0;
-	}
+	// microsec
+	const LatencyHistogram& Latencies() const {return _latencies;}
 
-	unsigned MedianLatency() const
-	{
-		if(_latencies.size() > 0)
-		{
-			size_t mi = _latencies.size() / 2;
-			return _latencies[mi];
-		}
-		else
-			return 0;
-	}
+	uint64_t MinLatency() const {return _latencies.min();}
+	uint64_t MaxLatency() const {return _latencies.max();}
+	uint64_t MedianLatency() const {return _latencies.p50();}
 
 	string toString() const
 	{
 		stringstream ss;
 		// stupid place to do it but I am short on time
 
-		ss << "Symbol " << Symbol() << ",AvgUpdateLatency " << AvgUpdateTopBookLatency() << ",MinLatency " << MinLatency() << ",MaxLatency " << MaxLatency() << ",MedianLatency " << MedianLatency() << ",UpdateCount " << UpdateCount() << ",MinBid " << MinBid() << ",MaxAsk " << MaxAsk();
+		ss << "Symbol " << Symbol() << ",AvgUpdateLatency " << AvgUpdateTopBookLatency() << ",MinLatency " << MinLatency() << ",MaxLatency " << MaxLatency() << ",MedianLatency " << MedianLatency()
+		   << ",P90Latency " << _latencies.p90() << ",P99Latency " << _latencies.p99() << ",P999Latency " << _latencies.p999()
+		   << ",UpdateCount " << UpdateCount() << ",MinBid " << priceToDouble(MinBid()) << ",MaxAsk " << priceToDouble(MaxAsk());
 		return ss.str();
 	}
 
@@ -323,21 +344,20 @@ private:
 		{
 			_avgUpdateLatency = _avgUpdateLatency + ((latency - _avgUpdateLatency)/_updateCount);
 		}
-		_latencies.push_back(latency);
+		_latencies.record(latency);
 	}
 
 	inline void increaseUpdateCount() {++_updateCount;}
 
 private:
-	string		 _symbol;
-	double	 	 _minBid{std::numeric_limits<double>::max()};
-	double       _maxAsk{std::numeric_limits<double>::min()};
+	SymbolID	 _symbol{InvalidSymbolID};
+	Price	 	 _minBid{std::numeric_limits<Price>::max()};
+	Price        _maxAsk{std::numeric_limits<Price>::min()};
 	unsigned int _updateCount{0};
+	unsigned int _messageCount{0};
 	double	 	 _avgUpdateLatency{0.0};
-	unsigned	 _minLatency{std::numeric_limits<unsigned>::max()};
-	unsigned	 _maxLatency{0};
 	// for median, percentiles
-	vector<unsigned> _latencies;
+	LatencyHistogram _latencies;
 };
 
 
@@ -348,25 +368,28 @@ public:
 	{
 	public:
 		CompositeTopLevel() {}
-		CompositeTopLevel(const string& symbol, const Side& bid, const Side& ask, const TimePoint& lastUpdate) : _symbol(symbol), _bid(bid), _ask(ask), _lastUpdate(lastUpdate) {}
-		inline const string& Symbol() const {return _symbol;}
+		CompositeTopLevel(SymbolID symbol, const Side& bid, const Side& ask, const TimePoint& lastUpdate) : _symbol(symbol), _bid(bid), _ask(ask), _lastUpdate(lastUpdate) {}
+		// a default constructed top level marks the end of a stream
+		inline bool isValid() const {return _symbol != InvalidSymbolID;}
+		inline SymbolID Symbolid() const {return _symbol;}
+		inline const string& Symbol() const {return SymbolTable::instance().name(_symbol);}
 		inline const Side& Bid() const {return _bid;}
 		inline const Side& Ask() const {return _ask;}
 		inline const TimePoint& LastUpdate() const {return _lastUpdate;}
 		string toString() const
 		{
 			stringstream ss;
-			ss << LastUpdate().toString() << "," << Symbol() << "," << Bid().price() << "," << Bid().qty() << "," << Ask().price() << "," << Ask().qty();
+			ss << LastUpdate().toString() << "," << Symbol() << "," << priceToDouble(Bid().price()) << "," << Bid().qty() << "," << priceToDouble(Ask().price()) << "," << Ask().qty();
 			return ss.str();
 		}
 	private:
-		string _symbol;
+		SymbolID _symbol{InvalidSymbolID};
 		Side _bid;
 		Side _ask;
 		TimePoint _lastUpdate;
 	};
 
-	CompositeBook(const string& symbol) : _symbol(symbol), _statistics(symbol) {}
+	CompositeBook(SymbolID symbol) : _symbol(symbol), _statistics(symbol) {}
 	~CompositeBook(){}
 
 
@@ -383,34 +406,15 @@ public:
 	bool update(const Record& record)
 	{
 		bool topChanged = false;
+		_statistics.increaseMessageCount();
 		Side oldTopBid = _topLevel.Bid();
 		Side oldTopAsk = _topLevel.Ask();
 
-
-		const string& symbol = record.Symbol();
-		const FeedID& feedid = record.Feedid();
-		if(_bookPerFeed.find(feedid)==_bookPerFeed.end())
-		{
-			// special case of not having any book yet!
-			if(_bookPerFeed.size()==0)
-			{
-				_topLevel.add(feedid, Side(record.Bid(), record.BidSize()), SideEnum::Bid);
-				_topLevel.add(feedid, Side(record.Ask(), record.AskSize()), SideEnum::Ask);
-			}
-
-			_bookPerFeed.emplace(feedid, BookPtr(new Book(symbol, feedid)));
-
-		}
-
-		_bookPerFeed[feedid]->update(record);
-
-		_mergeBid(feedid, record);
-		_mergeAsk(feedid, record);
-
-		if(_topLevel.BidCount() == 0)
-			_tryReplaceBid();
-		if(_topLevel.AskCount() == 0)
-			_tryReplaceAsk();
+		FeedID feedid = record.Feedid();
+		assert(feedid >= 0 && size_t(feedid) < MaxFeeds);
+		_present.set(feedid);
+		_topLevel.update(feedid, Side(record.Bid(), record.BidSize()), SideEnum::Bid);
+		_topLevel.update(feedid, Side(record.Ask(), record.AskSize()), SideEnum::Ask);
 
 		if(_topLevel.Bid()!=oldTopBid || _topLevel.Ask()!=oldTopAsk)
 		{
@@ -429,39 +433,27 @@ public:
 private:
 	bool checkConsistency() const
 	{
-		Side topBid(0.0,0);
-		Side topAsk(numeric_limits<double>::max(), 0);
-		for(const auto& p : _bookPerFeed)
-		{
-			const BookPtr& book = p.second;
-			assert(book->Symbol() == _symbol);
-
-			const Side& bid = book->bid();
+		Side topBid(0,0);
+		Side topAsk(numeric_limits<Price>::max(), 0);
+		_present.forEach([&](size_t feed){
+			Side bid = _topLevel.quote(feed, SideEnum::Bid);
 			if(bid.price() >= topBid.price())
 			{
 				if(bid.price() == topBid.price())
-				{
 					topBid.update(bid.price(), topBid.qty() + bid.qty());
-				}
 				else
-				{
 					topBid.update(bid.price(), bid.qty());
-				}
 			}
 
-			const Side& ask = book->ask();
+			Side ask = _topLevel.quote(feed, SideEnum::Ask);
 			if(ask.price() <= topAsk.price())
 			{
 				if(ask.price() == topAsk.price())
-				{
 					topAsk.update(ask.price(), topAsk.qty() + ask.qty());
-				}
 				else
-				{
 					topAsk.update(ask.price(), ask.qty());
-				}
 			}
-		}
+		});
 
 		if(_topLevel.Bid() != topBid)
 			return false;
@@ -475,114 +467,23 @@ private:
 	void updateStats(const Record& record)
 	{
 		//std::lock_guard<std::mutex> lock(_statisticsMutex);
-		_statistics.updateTopLevelChangeLatency(record.TimeStamp());
+		_statistics.updateTopLevelChangeLatency(record.Stamps().at(Stage::Read));
 		_statistics.trySetBid(_topLevel.Bid().price());
 		_statistics.trySetAsk(_topLevel.Ask().price());
 	}
 
-	void _tryReplaceBid()
-	{
-		vector<pair<FeedID,Side>> replacements;
-		double bestPrice = std::numeric_limits<double>::min();
-		for(auto& p : _bookPerFeed)
-		{
-			FeedID feedid = p.first;
-			const Side& bid = p.second->bid();
-			if(bid.price() > bestPrice)
-				bestPrice = bid.price();
-		}
-		// second pass
-		for(auto& p : _bookPerFeed)
-		{
-			FeedID feedid = p.first;
-			const Side& bid = p.second->bid();
-			if(bid.price() == bestPrice)
-				replacements.push_back(make_pair(feedid, bid));
-		}
-
-		for(auto& p : replacements)
-		{
-			_topLevel.add(p.first, p.second, SideEnum::Bid);
-		}
-
-
-	}
-
-	void _tryReplaceAsk()
-	{
-		vector<pair<FeedID,Side>> replacements;
-		double bestPrice = std::numeric_limits<double>::max();
-		for(auto& p : _bookPerFeed)
-		{
-			FeedID feedid = p.first;
-			const Side& ask = p.second->ask();
-			if(ask.price() < bestPrice)
-				bestPrice = ask.price();
-		}
-		// second pass
-		for(auto& p : _bookPerFeed)
-		{
-			FeedID feedid = p.first;
-			const Side& ask = p.second->ask();
-			if(ask.price() == bestPrice)
-				replacements.push_back(make_pair(feedid, ask));
-		}
-
-		for(auto& p : replacements)
-		{
-			_topLevel.add(p.first, p.second, SideEnum::Ask);
-		}
-	}
-
-
-	void _mergeBid(const FeedID& feedid, const Record& record)
-	{
-		if(_topLevel.feedInvolved(feedid, SideEnum::Bid))
-		{
-			if(record.Bid() < _topLevel.Bid().price())
-			{
-				_topLevel.remove(feedid, SideEnum::Bid);
-			}
-			else
-				_topLevel.add(feedid, Side(record.Bid(), record.BidSize()), SideEnum::Bid);
-		}
-		else
-		{
-			if(record.Bid() >= _topLevel.Bid().price())
-				_topLevel.add(feedid, Side(record.Bid(), record.BidSize()), SideEnum::Bid);
-		}
-	}
-
-	void _mergeAsk(const FeedID& feedid, const Record& record)
-	{
-		if(_topLevel.feedInvolved(feedid, SideEnum::Ask))
-		{
-			if(record.Ask() > _topLevel.Ask().price())
-			{
-				_topLevel.remove(feedid, SideEnum::Ask);
-			}
-			else
-				_topLevel.add(feedid, Side(record.Ask(), record.AskSize()), SideEnum::Ask);
-		}
-		else
-		{
-			if(record.Ask() <= _topLevel.Ask().price())
-				_topLevel.add(feedid, Side(record.Ask(), record.AskSize()), SideEnum::Ask);
-		}
-	}
-
 private:
-	string						   _symbol;
-	unordered_map<FeedID, BookPtr> _bookPerFeed;
-	TopLevel					   _topLevel;
+	SymbolID					   _symbol;
+	FeedMask					   _present;	// feeds which quoted the symbol
 	TimePoint					   _lastChangeTime;
+	TopLevel					   _topLevel;	// holds the per feed quotes too
 	//mutable	std::mutex			   _statisticsMutex;
 	BookStatistics				   _statistics;
 };
 
 bool operator==(const CompositeBook::CompositeTopLevel& lhs, const CompositeBook::CompositeTopLevel& rhs)
 {
-	return lhs.Symbol() == rhs.Symbol() && lhs.Bid() == rhs.Bid() && lhs.Ask() == rhs.Ask();
+	return lhs.Symbolid() == rhs.Symbolid() && lhs.Bid() == rhs.Bid() && lhs.Ask() == rhs.Ask();
 }
 
 bool operator!=(const CompositeBook::CompositeTopLevel& lhs, const CompositeBook::CompositeTopLevel& rhs)
@@ -593,6 +494,7 @@ bool operator!=(const CompositeBook::CompositeTopLevel& lhs, const CompositeBook
 
 
 typedef std::shared_ptr<CompositeBook> CompositeBookPtr;
-typedef unordered_map<string, CompositeBookPtr> CompositeBookMap;
+// indexed by SymbolID
+typedef vector<CompositeBookPtr> CompositeBookTable;
 
 #endif
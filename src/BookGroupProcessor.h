@@ -2,31 +2,75 @@
 #define _BOOKGROUPPROCESSOR_H
 
 #include <thread>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <unordered_map>
-#include <pthread.h>
 
 #include "Book.h"
 #include "Record.h"
-#include "Queue.h"
+#include "RecordPool.h"
+#include "SPSCRingBuffer.h"
 #include "Reporter.h"
+#include "ThreadPlacement.h"
 
 using namespace std;
 
 
-class BookGroupProcessor
+/*
+ * A symbol's book on its way from one processor to another. The router sends MigrateOut to the
+ * old processor behind the last record it routed there for the symbol and MigrateIn to the new one
+ * ahead of the first, so the book is handed over exactly between the two and the symbol's
+ * updates stay in order.
+ * */
+struct Migration
+{
+	Migration(SymbolID symbol_) : symbol(symbol_) {}
+
+	SymbolID		 symbol;
+	CompositeBookPtr book;					// null if the old processor never saw the symbol
+	std::atomic<bool> handedOver{false};	// book is set
+};
+
+/*
+ * What travels in a processor's ring: a record, a migration marker, or nullptr at the end.
+ * Kept to a pointer, the marker kind lives in the low bits of the Migration's address.
+ * */
+class ProcessorMessage
 {
 public:
-	BookGroupProcessor()
-	{
-		_processorThread = std::thread(&BookGroupProcessor::_processing, this);
-	}
+	enum Kind {Data = 0, MigrateOut = 1, MigrateIn = 2};
+
+	ProcessorMessage(RecordPtr rec = nullptr) : _bits(reinterpret_cast<uintptr_t>(rec)) {}
+	ProcessorMessage(Migration* migration, Kind kind) : _bits(reinterpret_cast<uintptr_t>(migration) | kind) {}
 
-#ifdef __unix__
-	BookGroupProcessor(int schedulingPolicy, int threadPriority) : BookGroupProcessor()
+	inline Kind		  kind() const {return Kind(_bits & KindMask);}
+	inline RecordPtr  record() const {return reinterpret_cast<RecordPtr>(_bits);}
+	inline Migration* migration() const {return reinterpret_cast<Migration*>(_bits & ~KindMask);}
+
+private:
+	static constexpr uintptr_t KindMask = 3;
+	static_assert(alignof(Migration) > KindMask && alignof(Record) > KindMask, "no room for the kind");
+
+	uintptr_t _bits;
+};
+
+/*
+ * Owns the books of a group of symbols, fed through its own ring.
+ * The thread places itself before it allocates anything, so its queue and books are first
+ * touched - and with a pinned thread end up - on the cpu's local NUMA node.
+ * */
+class BookGroupProcessor
+{
+public:
+	BookGroupProcessor(const ThreadPlacement& placement = ThreadPlacement())
 	{
-		_setScheduling(schedulingPolicy, threadPriority);
+		std::promise<void> ready;
+		std::future<void> queueAllocated = ready.get_future();
+		_processorThread = std::thread(&BookGroupProcessor::_processing, this, placement, std::move(ready));
+		queueAllocated.wait();
 	}
-#endif
 
 	~BookGroupProcessor()
 	{
@@ -38,14 +82,9 @@ public:
 		_reporter = reporter;
 	}
 
-#ifdef __unix__
-	void setSchedulingPolicy(int schedulingPolicy, int threadPriority)
-	{
-		_setScheduling(schedulingPolicy, threadPriority);
-	}
-#endif
-
-	void send(const RecordPtr& rec) {_recordQueue.push(rec);}
+	void send(const ProcessorMessage& msg) {_recordQueue->push(msg);}
+	template<class It>
+	void sendBatch(It first, It last) {_recordQueue->pushBatch(first, last);}
 
 	void join()
 	{
@@ -53,36 +92,48 @@ public:
 			_processorThread.join();
 	}
 
-	const unordered_map<string, BookStatistics>& bookStats() const {return _bookStats;}
+	const unordered_map<SymbolID, BookStatistics>& bookStats() const {return _bookStats;}
+	// records processed, read after join
+	size_t messageCount() const {return _messageCount;}
+	// time the records spent in each stage, read after join
+	const StageLatencies& stageLatencies() const {return _stageLatencies;}
 
-private:
-
-#ifdef __unix__
-	void _setScheduling(int schedulingPolicy, int threadPriority)
-	{
-		sched_param sch_params;
-		sch_params.sched_priority = threadPriority;
-		pthread_setschedparam(_processorThread.native_handle(), schedulingPolicy, &sch_params);
-	}
-#endif
+	// for the rebalancer, from any thread
+	size_t queueDepth() const {return _recordQueue->size();}
+	size_t queueCapacity() const {return _recordQueue->capacity();}
+	uint64_t busyNanos() const {return _busyNanos.load(std::memory_order_relaxed);}
 
-	void _processing()
+private:
+	void _processing(ThreadPlacement placement, std::promise<void> ready)
 	{
-		while(true)
+		placement.applyToCurrentThread("book processor");
+		_recordQueue.reset(new SPSCRingBuffer<ProcessorMessage>(QueueCapacity));
+		ready.set_value();
+
+		vector<ProcessorMessage> batch;
+		batch.reserve(BatchSize);
+		bool ended = false;
+		while(!ended && _recordQueue->drainTo(batch, BatchSize) > 0)
 		{
-			RecordPtr rec{nullptr};
-			if(_recordQueue.pop(rec))
+			TscClock::Ticks dequeued = TscClock::now();
+			for(const ProcessorMessage& msg : batch)
 			{
-				bool doPublish = false;
-				if(rec)
+				RecordPtr rec = msg.record();
+				if(msg.kind() == ProcessorMessage::MigrateOut)
+					_migrateOut(*msg.migration());
+				else if(msg.kind() == ProcessorMessage::MigrateIn)
+					_migrateIn(*msg.migration());
+				else if(rec)
 				{
-					const string& symbol = rec->Symbol();
-					if(_books.find(symbol)==_books.end())
-					{
-						_books[symbol] = CompositeBookPtr(new CompositeBook(symbol));
-					}
-
+					++_messageCount;
+					rec->stamp(Stage::Dequeued, dequeued);
+					SymbolID symbol = rec->Symbolid();
+					if(symbol >= _books.size())
+						_books.resize(symbol+1);
 					CompositeBookPtr& book = _books[symbol];
+					if(!book)
+						book = CompositeBookPtr(new CompositeBook(symbol));
+
 					bool topofBookChanged = book->update(*rec);
 					if(topofBookChanged)
 					{
@@ -90,36 +141,65 @@ private:
 						if(_reporter)
 							_reporter->publish(top);
 					}
-					delete rec;
+					rec->stamp(Stage::Applied);
+					_stageLatencies.record(rec->Stamps());
+					RecordPool::release(rec);
 
 				}
 				else
 				{
 					_reporter->publish(CompositeBook::CompositeTopLevel{});
+					ended = true;
 					break;
 				}
 			}
-			else
-				break;
-
+			batch.clear();
+			_busyNanos.fetch_add(TscClock::nanosBetween(dequeued, TscClock::now()), std::memory_order_relaxed);
 		}
 
 		_prepareBookStatistics();
 
 	}
 
+	void _migrateOut(Migration& migration)
+	{
+		if(migration.symbol < _books.size())
+			migration.book = std::move(_books[migration.symbol]);
+		migration.handedOver.store(true, std::memory_order_release);
+	}
+
+	// waits for the old processor to get through its records of the symbol, it never waits on us
+	void _migrateIn(Migration& migration)
+	{
+		Backoff backoff;
+		while(!migration.handedOver.load(std::memory_order_acquire))
+			backoff.pause();
+		if(!migration.book)
+			return;
+		if(migration.symbol >= _books.size())
+			_books.resize(migration.symbol+1);
+		_books[migration.symbol] = std::move(migration.book);
+	}
+
 	void _prepareBookStatistics()
 	{
-		for(const auto& p : _books)
+		for(const auto& book : _books)
 		{
-			_bookStats[p.first] = p.second->getStatistics();
+			if(book)
+				_bookStats[book->getStatistics().Symbolid()] = book->getStatistics();
 		}
 	}
 
 private:
-	unordered_map<string, BookStatistics> _bookStats;
-	BlockingQueue<RecordPtr> _recordQueue;
-	CompositeBookMap 		 _books;
+	static constexpr size_t QueueCapacity = 1 << 16;
+	static constexpr size_t BatchSize = 256;
+
+	unordered_map<SymbolID, BookStatistics> _bookStats;
+	size_t					 _messageCount{0};
+	StageLatencies			 _stageLatencies;
+	std::atomic<uint64_t>	 _busyNanos{0};
+	unique_ptr<SPSCRingBuffer<ProcessorMessage>> _recordQueue;
+	CompositeBookTable 		 _books;
 	std::thread 			 _processorThread;
 	ReporterPtr				 _reporter;
 };
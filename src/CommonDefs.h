@@ -2,6 +2,7 @@
 #define _COMMONDEFS_H
 
 #include "Logger.h"
+#include "Price.h"
 #include <iostream>
 #include <cstdio>
 #include <vector>
@@ -0,0 +1,191 @@
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <sstream>
+#include "ThreadPlacement.h"
+#include "Logger.h"
+#include "FeedMask.h"
+
+using namespace std;
+
+/*
+ * Command line of the merger:
+ *   mdm [options] feed...
+ * where a feed is [reader:]path.
+ * */
+struct Config
+{
+	vector<string> feeds;
+	int			   processors{6};
+	// 0 parses on the merge thread, otherwise the number of threads parsing ahead of the merge
+	size_t		   readerThreads{0};
+	// records each feed may have parsed ahead
+	size_t		   readAheadDepth{4096};
+	// route records from the feed thread straight to the book processors, skipping the multiplexer
+	bool		   directRouting{false};
+	ThreadLayout   threads;
+	// assign symbols to processors by their message rates instead of by id
+	bool		   loadAwarePartition{false};
+	// symbol,rate lines to partition by, e.g. written by a previous run with --save-rates
+	string		   ratesFile;
+	// where to write the message count of each symbol seen in this run
+	string		   saveRatesFile;
+	// how often the rebalancer looks at the processors, 0 keeps the partition as it is
+	size_t		   rebalanceMillis{0};
+	// where the composite top of book stream goes, - for stdout, empty for nowhere
+	string		   output;
+	// the reporter gets only the newest top of book of a symbol it fell behind on
+	bool		   conflate{false};
+	// entries below it are skipped at the call site
+	Logger::Level  logLevel{Logger::Level::Info};
+
+	static string usage()
+	{
+		return "usage: mdm [options] [reader:]feed...\n"
+			   "  readers: mmap, bin - a binary capture written by csv2bin, gz - a gzip compressed csv\n"
+			   "  --readers N      parse the feeds on N threads ahead of the merge\n"
+			   "  --read-ahead N   records parsed ahead per feed (default 4096)\n"
+			   "  --routing R      multiplexed (default) or direct from the feed thread to the processors\n"
+			   "  --processors N   book processor threads (default 6)\n"
+			   "  --cpu-feed C, --cpu-mux C, --cpu-reporter C, --cpu-logger C\n"
+			   "                   pin the merging, multiplexer, reporter or logger thread to cpu C\n"
+			   "  --cpu-readers L, --cpu-processors L\n"
+			   "                   pin the reader or processor threads round robin to the cpus in L, e.g. 2-5,8\n"
+			   "  --rt-priority P  SCHED_FIFO priority of the feed, reader, multiplexer and processor threads\n"
+			   "  --partition P    hash (default) or load: heavy symbols get their own processors, the rest is packed\n"
+			   "  --rates F        symbol,rate lines the partition is built from\n"
+			   "  --save-rates F   write the message count of every symbol seen to F\n"
+			   "  --rebalance-ms N move symbols off a processor which stays overloaded, checked every N ms\n"
+			   "  --output F       write every composite top of book change to F, - for stdout\n"
+			   "  --publication P  queued (default): report every change, conflated: only the newest per symbol\n"
+			   "                   once the reporter falls behind\n"
+			   "  --log-level L    debug, info (default) or warning\n";
+	}
+
+	static Config fromCommandLine(int argc, char** argv)
+	{
+		Config config;
+		for(int i=1;i<argc;i++)
+		{
+			string arg{argv[i]};
+			if(arg.compare(0, 2, "--") != 0)
+			{
+				config.feeds.push_back(arg);
+				continue;
+			}
+			if(i+1 >= argc)
+				throw invalid_argument("missing value for " + arg);
+			string value{argv[++i]};
+			if(arg == "--readers")
+				config.readerThreads = _toNumber(arg, value);
+			else if(arg == "--read-ahead")
+				config.readAheadDepth = _toNumber(arg, value);
+			else if(arg == "--processors")
+			{
+				config.processors = _toNumber(arg, value);
+				if(config.processors < 1)
+					throw invalid_argument("invalid value " + value + " for " + arg);
+			}
+			else if(arg == "--cpu-feed")
+				config.threads.feedCpu = _toNumber(arg, value);
+			else if(arg == "--cpu-mux")
+				config.threads.multiplexerCpu = _toNumber(arg, value);
+			else if(arg == "--cpu-reporter")
+				config.threads.reporterCpu = _toNumber(arg, value);
+			else if(arg == "--cpu-logger")
+				config.threads.loggerCpu = _toNumber(arg, value);
+			else if(arg == "--cpu-readers")
+				config.threads.readerCpus = _toCpuList(arg, value);
+			else if(arg == "--cpu-processors")
+				config.threads.processorCpus = _toCpuList(arg, value);
+			else if(arg == "--rt-priority")
+				config.threads.realTimePriority = _toNumber(arg, value);
+			else if(arg == "--partition")
+			{
+				if(value != "hash" && value != "load")
+					throw invalid_argument("invalid value " + value + " for " + arg);
+				config.loadAwarePartition = value == "load";
+			}
+			else if(arg == "--rates")
+				config.ratesFile = value;
+			else if(arg == "--save-rates")
+				config.saveRatesFile = value;
+			else if(arg == "--rebalance-ms")
+				config.rebalanceMillis = _toNumber(arg, value);
+			else if(arg == "--output")
+				config.output = value;
+			else if(arg == "--publication")
+			{
+				if(value != "queued" && value != "conflated")
+					throw invalid_argument("invalid value " + value + " for " + arg);
+				config.conflate = value == "conflated";
+			}
+			else if(arg == "--log-level")
+			{
+				if(value == "debug")
+					config.logLevel = Logger::Level::Debug;
+				else if(value == "info")
+					config.logLevel = Logger::Level::Info;
+				else if(value == "warning")
+					config.logLevel = Logger::Level::Warning;
+				else
+					throw invalid_argument("invalid value " + value + " for " + arg);
+			}
+			else if(arg == "--routing")
+			{
+				if(value != "direct" && value != "multiplexed")
+					throw invalid_argument("invalid value " + value + " for " + arg);
+				config.directRouting = value == "direct";
+			}
+			else
+				throw invalid_argument("unknown option " + arg);
+		}
+		if(config.feeds.size() > MaxFeeds)
+			throw invalid_argument("at most " + to_string(MaxFeeds) + " feeds, build with a larger MDM_MAX_FEEDS");
+		return config;
+	}
+
+private:
+	static size_t _toNumber(const string& option, const string& value)
+	{
+		size_t pos = 0;
+		unsigned long n = 0;
+		try
+		{
+			n = stoul(value, &pos);
+		}
+		catch(const exception&)
+		{
+			pos = 0;
+		}
+		if(pos == 0 || pos != value.size())
+			throw invalid_argument("invalid value " + value + " for " + option);
+		return n;
+	}
+
+	// comma separated cpus and ranges of cpus: 0,2-5
+	static vector<int> _toCpuList(const string& option, const string& value)
+	{
+		vector<int> cpus;
+		stringstream ss(value);
+		string item;
+		while(getline(ss, item, ','))
+		{
+			size_t dash = item.find('-');
+			int first = _toNumber(option, item.substr(0, dash));
+			int last = dash == string::npos ? first : _toNumber(option, item.substr(dash+1));
+			if(last < first)
+				throw invalid_argument("invalid value " + value + " for " + option);
+			for(int cpu=first;cpu<=last;cpu++)
+				cpus.push_back(cpu);
+		}
+		if(cpus.empty())
+			throw invalid_argument("invalid value " + value + " for " + option);
+		return cpus;
+	}
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef _CONFLATINGQUEUE_H
+#define _CONFLATINGQUEUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include "MPSCRingBuffer.h"
+#include "SymbolTable.h"
+
+/*
+ * Latest value per symbol for a consumer which may fall behind: a push overwrites the symbol's
+ * slot and only queues the symbol if it is not queued already, so the consumer sees the newest
+ * value of each symbol once however many pushes it missed. Pushes folded into a pending one are
+ * counted as conflated. Memory stays at one slot per symbol seen and one queue entry per dirty
+ * symbol.
+ * A symbol has one producer at a time, a later producer has to be handed the symbol with
+ * release/acquire ordering - as the book migration does. Slots are read under a sequence lock,
+ * producers only wait for the consumer if more symbols than the capacity are dirty at once.
+ * The value is kept as relaxed atomic words, a read racing a write is thrown away by the version
+ * check but is no data race, so T has to be trivially copyable.
+ * Pushing InvalidSymbolID passes a default constructed T through as the end marker, behind every
+ * value its producer pushed before.
+ * */
+template<class T>
+class ConflatingQueue
+{
+	static_assert(std::is_trivially_copyable_v<T>, "values are copied word by word");
+
+public:
+	ConflatingQueue(size_t capacity) : _dirty(capacity) {}
+	~ConflatingQueue()
+	{
+		for(auto& chunk : _chunks)
+			delete[] chunk.load(std::memory_order_relaxed);
+	}
+	ConflatingQueue(const ConflatingQueue&) = delete;
+	ConflatingQueue& operator=(const ConflatingQueue&) = delete;
+
+	void push(SymbolID symbol, const T& val)
+	{
+		if(symbol == InvalidSymbolID)
+		{
+			_dirty.push(InvalidSymbolID);
+			return;
+		}
+		Slot& slot = _slot(symbol);
+		uint32_t version = slot.version.load(std::memory_order_relaxed);
+		slot.version.store(version+1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		uint64_t words[Words]{};
+		memcpy(words, &val, sizeof(T));
+		for(size_t i=0;i<Words;i++)
+			slot.value[i].store(words[i], std::memory_order_relaxed);
+		slot.version.store(version+2, std::memory_order_seq_cst);
+		// the consumer clears queued before it reads, so either it reads this value or we queue again
+		if(slot.queued.exchange(true, std::memory_order_seq_cst))
+			_conflated.fetch_add(1, std::memory_order_relaxed);
+		else
+			_dirty.push(symbol);
+	}
+
+	// calls read(const T&) with the newest value of up to max dirty symbols, never waits
+	template<class F>
+	size_t consume(F&& read, size_t max)
+	{
+		return _dirty.consume([this, &read](SymbolID symbol) {
+			if(symbol == InvalidSymbolID)
+			{
+				read(T{});
+				return;
+			}
+			Slot& slot = _slot(symbol);
+			slot.queued.store(false, std::memory_order_seq_cst);
+			uint64_t words[Words];
+			uint32_t before, after;
+			do
+			{
+				before = slot.version.load(std::memory_order_seq_cst);
+				for(size_t i=0;i<Words;i++)
+					words[i] = slot.value[i].load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				after = slot.version.load(std::memory_order_relaxed);
+			} while(before != after || (before & 1));
+			T val;
+			memcpy(&val, words, sizeof(T));
+			read(static_cast<const T&>(val));
+		}, max);
+	}
+
+	void requestStop() {_dirty.requestStop();}
+	bool stopRequested() const {return _dirty.stopRequested();}
+	bool isEmpty() const {return _dirty.isEmpty();}
+
+	size_t conflatedCount() const {return _conflated.load(std::memory_order_relaxed);}
+
+private:
+	static constexpr size_t Words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	struct alignas(MPSCRingBuffer<SymbolID>::CacheLine) Slot
+	{
+		std::atomic<uint32_t> version{0};		// odd while a producer writes
+		std::atomic<bool>	  queued{false};
+		std::atomic<uint64_t> value[Words]{};
+	};
+
+	static constexpr size_t ChunkBits = 10;
+	static constexpr size_t ChunkSize = 1 << ChunkBits;
+	static constexpr size_t MaxChunks = 4096;	// as many symbols as the SymbolTable holds
+
+	// slots come in chunks which never move, allocated by the first producer of a symbol in them
+	Slot& _slot(SymbolID symbol)
+	{
+		std::atomic<Slot*>& chunk = _chunks[symbol >> ChunkBits];
+		Slot* slots = chunk.load(std::memory_order_acquire);
+		if(!slots)
+		{
+			Slot* fresh = new Slot[ChunkSize];
+			if(chunk.compare_exchange_strong(slots, fresh, std::memory_order_acq_rel))
+				slots = fresh;
+			else
+				delete[] fresh;
+		}
+		return slots[symbol & (ChunkSize-1)];
+	}
+
+private:
+	std::atomic<Slot*>		 _chunks[MaxChunks]{};
+	MPSCRingBuffer<SymbolID> _dirty;
+	std::atomic<size_t>		 _conflated{0};
+};
+
+#endif
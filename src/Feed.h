@@ -2,9 +2,16 @@
 #define _FEED_H
 
 #include "Record.h"
+#include "RecordPool.h"
 #include "InputReader.h"
+#include "BinaryFormat.h"
+#include "SPSCRingBuffer.h"
+#include "ThreadPlacement.h"
 #include "Logger.h"
 #include "CommonDefs.h"
+#include <cassert>
+#include <limits>
+#include <atomic>
 
 using namespace std;
 
@@ -15,100 +22,347 @@ public:
 	Feed(const InputReaderPtr& input, FeedID feedID) : _feedID(feedID), _input(input), _cache(nullptr)
 	{
 	}
-	~Feed() {}
+	~Feed()
+	{
+		// whatever was read ahead but never merged
+		RecordPtr rec{nullptr};
+		while(_readAhead && _readAhead->tryPop(rec))
+			RecordPool::release(rec);
+		RecordPool::release(_pending);
+	}
 	const bool 	 		readNextRecordToCache()
 	{
-		string line;
+		if(_readAhead)
+		{
+			_cache = _popReadAhead();
+			return _cache != nullptr;
+		}
+
+		_cache = nullptr;
+		return _readRecord(_cache);
+	}
+
+	// skips lines which do not parse, false once the input is exhausted
+	bool				 readNextValidRecordToCache()
+	{
+		while(isValid())
+		{
+			if(readNextRecordToCache())
+				return true;
+		}
+		return false;
+	}
+	const RecordPtr&	 cache() const {return _cache;}
+	void				 clearCache() { _cache = nullptr; }
+
+	inline bool			 isValid() const
+	{
+		if(_readAhead)
+			return !_readAheadDrained;
+		return _input && _input->isValid();
+	}
+
+	// from now on the input is read and parsed by fillReadAhead() on a reader thread
+	// and readNextRecordToCache() only takes the parsed records from the buffer
+	void enableReadAhead(size_t depth)
+	{
+		assert(!_readAhead);
+		_readAhead.reset(new SPSCRingBuffer<RecordPtr>(depth));
+	}
+
+	// reader thread side: parses up to maxRecords while there is room in the buffer, returns
+	// how many were added - once the input is exhausted isReadAheadDone() turns true
+	size_t				 fillReadAhead(size_t maxRecords)
+	{
+		size_t count = 0;
+		while(count < maxRecords && !_readAheadDone.load(std::memory_order_relaxed))
+		{
+			if(!_pending)
+			{
+				while(_input && _input->isValid() && !_readRecord(_pending));
+				if(!_pending)
+				{
+					_readAheadDone.store(true, std::memory_order_release);
+					break;
+				}
+			}
+			if(!_readAhead->tryPush(_pending))
+				break;
+			_pending = nullptr;
+			++count;
+		}
+		return count;
+	}
+
+	bool				 isReadAheadDone() const {return _readAheadDone.load(std::memory_order_acquire);}
+
+protected:
+	// false if the line was invalid or the input ran out
+	bool				 _readRecord(RecordPtr& rec)
+	{
+		string_view line;
 		Tokenizer tokenizer(',');
-		if(_input->isValid())
+		if(_input && _input->isValid() && _input->isBinary())
+			return _readBinaryRecord(rec);
+		if(_input && _input->isValid())
 		{
-			_input->readLine(line);
-			//cout << "Line read " << line << endl;
+			if(!_input->readLineView(line))
+			{
+				// done with it, let go of the file
+				_input.reset();
+				return false;
+			}
 			try
 			{
-				_cache = RecordPtr(new Record(line, tokenizer, _feedID, chrono::high_resolution_clock::now()));
+				rec = RecordPool::create(line, tokenizer, _symbols, _feedID, TscClock::now());
 				return true;
 			}
-			catch(const Record::RecordInvalid& e)
+			catch(const Record::RecordInvalid&)
 			{
-				//LOG("record invalid exception:" + string(e.what()) + "End of line");
-				//cout << "record invalid exception:" << string(e.what()) << "End of line" << endl;
-				_cache = nullptr;
+				LOG_WARN("record invalid: {}", line);
 			}
 		}
 
 		return false;
+	}
 
+	bool				 _readBinaryRecord(RecordPtr& rec)
+	{
+		const BinaryRecord* in;
+		SymbolID symbol;
+		TscClock::Ticks readTicks = TscClock::now();
+		if(!_input->readBinaryRecord(in, symbol))
+		{
+			if(!_input->isValid())
+				_input.reset();
+			return false;
+		}
+		rec = RecordPool::create(TimePoint::fromNanos(in->time), symbol, in->bid, in->bidSize, in->ask, in->askSize, _feedID, readTicks);
+		return true;
+	}
 
+	// merge side of read ahead, waits for the reader thread if it is behind
+	RecordPtr			 _popReadAhead()
+	{
+		RecordPtr rec{nullptr};
+		Backoff backoff;
+		while(!_readAhead->tryPop(rec))
+		{
+			if(_readAheadDone.load(std::memory_order_acquire))
+			{
+				// the last records may have landed just before done was set
+				if(_readAhead->tryPop(rec))
+					break;
+				_readAheadDrained = true;
+				return nullptr;
+			}
+			backoff.pause();
+		}
+		return rec;
 	}
-	const RecordPtr&	 cache() const {return _cache;}
-	void				 clearCache() { _cache = nullptr; }
 
-	inline bool			 isValid() const {return _input->isValid();}
 protected:
 	FeedID			_feedID;
 	InputReaderPtr 	_input;
 	RecordPtr		_cache;
+	SymbolCache		_symbols;
+
+	// read ahead mode
+	unique_ptr<SPSCRingBuffer<RecordPtr>> _readAhead;
+	RecordPtr		_pending{nullptr};			// parsed but did not fit in the buffer yet
+	atomic<bool>	_readAheadDone{false};		// set by the reader thread
+	bool			_readAheadDrained{false};	// set by the merge thread
 };
 
 typedef std::shared_ptr<Feed> FeedPtr;
 
 
+/*
+ * k-way merge of the feeds by time over a loser tree: every internal node remembers the loser
+ * of the match played there, so replacing the winner's record only replays the matches on its
+ * path to the root - O(log feeds) per record instead of scanning every feed.
+ * Ties go to the feed added first.
+ * Feeds are first read when the merge starts, so with lazily opened inputs nothing is opened
+ * before that, and a feed gives up its input as soon as it runs dry. The merge needs the head
+ * record of every feed, so every input is open from then on: only mmap: and bin: inputs, which
+ * close their descriptor once mapped, keep a merge of more feeds than the descriptor limit going.
+ * */
 class ConsolidatedFeed
 {
 public:
 	void	  addFeed(const FeedPtr& feed)
 	{
+		assert(!_started);
 		_feeds.push_back(feed);
 	}
+
 	RecordPtr nextRecord()
 	{
-		RecordPtr oldestRecord{nullptr};
-		TimePoint oldestTime;
-		int		  oldestFeedIndex = 0;
-		for(int i=0;i<_feeds.size();i++)
+		if(!_started)
+			_build();
+
+		size_t winner = _winner;
+		if(_keys[winner] == Exhausted)
+			return nullptr;
+
+		FeedPtr& feed = _feeds[winner];
+		RecordPtr oldestRecord = feed->cache();
+		feed->clearCache();
+		_keys[winner] = _fill(winner);
+		_replay(winner);
+
+		return oldestRecord;
+	}
+
+private:
+	static constexpr int64_t Exhausted = numeric_limits<int64_t>::max();
+
+	// the merge key of the feed's next record
+	int64_t _fill(size_t i)
+	{
+		FeedPtr& feed = _feeds[i];
+		if(feed->cache()!=nullptr || feed->readNextValidRecordToCache())
+			return feed->cache()->Time().nanos();
+		return Exhausted;
+	}
+
+	inline bool _beats(size_t a, size_t b) const
+	{
+		return _keys[a] < _keys[b] || (_keys[a] == _keys[b] && a < b);
+	}
+
+	void _build()
+	{
+		_started = true;
+		_leaves = 1;
+		while(_leaves < _feeds.size())
+			_leaves <<= 1;
+		_keys.assign(_leaves, Exhausted);
+		for(size_t i=0;i<_feeds.size();i++)
+			_keys[i] = _fill(i);
+		_losers.assign(_leaves, 0);
+		_winner = _buildNode(1);
+	}
+
+	// returns the winner of the subtree
+	size_t _buildNode(size_t node)
+	{
+		if(node >= _leaves)
+			return node - _leaves;
+		size_t left = _buildNode(2*node);
+		size_t right = _buildNode(2*node+1);
+		if(_beats(left, right))
 		{
-			FeedPtr& feed = _feeds[i];
-			if(feed->isValid())
-			{
-				TimePoint time;
-				if(feed->cache()!=nullptr)
-				{
-					time = feed->cache()->Time();
-				}
-				else
-				{
-					if(feed->readNextRecordToCache())
-						time = feed->cache()->Time();
-				}
+			_losers[node] = right;
+			return left;
+		}
+		_losers[node] = left;
+		return right;
+	}
 
-				if(!oldestTime.isValid())
-				{
-					oldestTime = time;
-					oldestFeedIndex = i;
-				}
-				else if(oldestTime>time)
-				{
-					oldestTime = time;
-					oldestFeedIndex = i;
-				}
-			}
+	void _replay(size_t leaf)
+	{
+		size_t winner = leaf;
+		for(size_t node = (leaf + _leaves) >> 1;node >= 1;node >>= 1)
+		{
+			if(_beats(_losers[node], winner))
+				std::swap(_losers[node], winner);
 		}
+		_winner = winner;
+	}
+
+private:
+	vector<FeedPtr> _feeds;
+	bool			_started{false};
+	size_t			_leaves{1};
+	size_t			_winner{0};
+	vector<int64_t> _keys;		// per leaf, padded up to a power of two
+	vector<size_t>	_losers;	// per internal node, the root is 1
+};
+
+
+
+
+
+/*
+ * Reader threads parsing ahead of the merge into each feed's read ahead buffer. The feeds are
+ * dealt out round robin, a thread cycles over its feeds topping up their buffers a slice at a
+ * time and backs off when all of them are full.
+ * */
+class FeedReaderPool
+{
+public:
+	FeedReaderPool(size_t threadCount, size_t bufferDepth, const ThreadLayout& layout = ThreadLayout()) : _threadCount(std::max<size_t>(1, threadCount)),
+																											_bufferDepth(bufferDepth),
+																											_layout(layout) {}
+	~FeedReaderPool()
+	{
+		requestStop();
+		join();
+	}
+
+	void addFeed(const FeedPtr& feed)
+	{
+		feed->enableReadAhead(_bufferDepth);
+		_feeds.push_back(feed);
+	}
 
-		if(oldestTime.isValid())
+	void start()
+	{
+		for(size_t t=0;t<std::min(_threadCount, _feeds.size());t++)
 		{
-			oldestRecord = _feeds[oldestFeedIndex]->cache();
-			_feeds[oldestFeedIndex]->clearCache();
+			vector<FeedPtr> assigned;
+			for(size_t i=t;i<_feeds.size();i+=_threadCount)
+				assigned.push_back(_feeds[i]);
+			_readers.push_back(thread(&FeedReaderPool::_reading, this, t, std::move(assigned)));
 		}
+	}
 
-		return oldestRecord;
+	void requestStop() {_stopRequested.store(true);}
 
+	void join()
+	{
+		for(thread& t : _readers)
+			if(t.joinable())
+				t.join();
 	}
+
 private:
-	vector<FeedPtr> _feeds;
-};
+	void _reading(size_t index, vector<FeedPtr> feeds)
+	{
+		_layout.reader(index).applyToCurrentThread("feed reader");
+		const size_t slice = 256;
+		Backoff backoff;
+		while(!feeds.empty() && !_stopRequested.load(std::memory_order_relaxed))
+		{
+			size_t produced = 0;
+			for(size_t i=0;i<feeds.size();)
+			{
+				produced += feeds[i]->fillReadAhead(slice);
+				if(feeds[i]->isReadAheadDone())
+				{
+					feeds[i] = feeds.back();
+					feeds.pop_back();
+				}
+				else
+					i++;
+			}
 
+			if(produced > 0)
+				backoff.reset();
+			else
+				backoff.pause();
+		}
+	}
 
+private:
+	size_t			 _threadCount;
+	size_t			 _bufferDepth;
+	ThreadLayout	 _layout;
+	vector<FeedPtr>	 _feeds;
+	vector<thread>	 _readers;
+	atomic<bool>	 _stopRequested{false};
+};
 
 
 
@@ -122,15 +376,32 @@ public:
 
 	void addFeed(FeedPtr&& feed)
 	{
+		_feeds.push_back(feed);
 		_consolidatedFeed.addFeed(std::forward<FeedPtr>(feed));
 	}
 
+	// has to be called before start and before enableReadAhead
+	void setThreadLayout(const ThreadLayout& layout) {_layout = layout;}
+
+	// parse on readerThreads threads ahead of the merge, bufferDepth records per feed
+	// has to be called before start
+	void enableReadAhead(size_t readerThreads, size_t bufferDepth)
+	{
+		_readerPool.reset(new FeedReaderPool(readerThreads, bufferDepth, _layout));
+	}
+
 	void registerNewRecordCB(const NewRecordCB& cb_) {_newRecordCB = cb_;}
 	//void registerEndOfDayCB(const EndOfDayCB& cb_) {_endOfDayCB = cb_;}
 
 	// should be called after registering the callbacks
 	void start()
 	{
+		if(_readerPool)
+		{
+			for(const FeedPtr& feed : _feeds)
+				_readerPool->addFeed(feed);
+			_readerPool->start();
+		}
 		_recordProducerThread = thread(&FeedManager::_process, this);
 	}
 
@@ -138,12 +409,15 @@ public:
 	{
 		if(_recordProducerThread.joinable())
 			_recordProducerThread.join();
+		if(_readerPool)
+			_readerPool->join();
 	}
 
 
 private:
 	void _process()
 	{
+		_layout.feed().applyToCurrentThread("feed");
 		while(true)
 		{
 			RecordPtr rec = _consolidatedFeed.nextRecord();
@@ -151,12 +425,15 @@ private:
 			if(!rec)
 				break;
 		}
-		//LOG("Reached end of all feeds.");
+		LOG_INFO("Reached end of all feeds.");
 	}
 
 
 private:
+	vector<FeedPtr>					_feeds;
 	ConsolidatedFeed				_consolidatedFeed;
+	unique_ptr<FeedReaderPool>		_readerPool;
+	ThreadLayout					_layout;
 	NewRecordCB						_newRecordCB;
 	//EndOfDayCB						_endOfDayCB;
 	thread							_recordProducerThread;
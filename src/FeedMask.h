@@ -0,0 +1,166 @@
+#ifndef _FEEDMASK_H
+#define _FEEDMASK_H
+
+#include <cstdint>
+#include <cstddef>
+#include <climits>
+#include <vector>
+
+/*
+ * Feed ids are dense from 0, so per feed state of a book lives in arrays indexed by feed and sets
+ * of feeds are bitmasks. By default both grow with the highest feed id a book sees, so any number
+ * of feeds can be merged. Building with MDM_MAX_FEEDS fixes them at that many feeds instead: the
+ * arrays live inside the book and the masks are plain words, and more feeds are refused.
+ * */
+#ifdef MDM_MAX_FEEDS
+constexpr bool	 FixedFeedCount = true;
+constexpr size_t MaxFeeds = MDM_MAX_FEEDS;
+#else
+constexpr bool	 FixedFeedCount = false;
+constexpr size_t MaxFeeds = INT_MAX;	// as many as a FeedID holds
+#endif
+
+static_assert(MaxFeeds > 0, "MDM_MAX_FEEDS must be positive");
+
+template<size_t Bits>
+class FeedMaskT
+{
+public:
+	static constexpr size_t Words = (Bits + 63) / 64;
+
+	inline void set(size_t i) {_words[i >> 6] |= _bit(i);}
+	inline void reset(size_t i) {_words[i >> 6] &= ~_bit(i);}
+	inline bool test(size_t i) const {return (_words[i >> 6] & _bit(i)) != 0;}
+
+	// just i
+	inline void only(size_t i)
+	{
+		clear();
+		set(i);
+	}
+
+	inline void clear()
+	{
+		for(size_t w=0;w<Words;w++)
+			_words[w] = 0;
+	}
+
+	inline bool none() const
+	{
+		for(size_t w=0;w<Words;w++)
+			if(_words[w])
+				return false;
+		return true;
+	}
+
+	inline unsigned count() const
+	{
+		unsigned n = 0;
+		for(size_t w=0;w<Words;w++)
+			n += __builtin_popcountll(_words[w]);
+		return n;
+	}
+
+	// calls f(i) for every set i in increasing order
+	template<class F>
+	inline void forEach(F&& f) const
+	{
+		for(size_t w=0;w<Words;w++)
+			for(uint64_t bits = _words[w];bits;bits &= bits-1)
+				f(w*64 + __builtin_ctzll(bits));
+	}
+
+private:
+	static inline uint64_t _bit(size_t i) {return uint64_t(1) << (i & 63);}
+
+	uint64_t _words[Words]{};
+};
+
+/*
+ * The same for any number of feeds: the first 64 in a word of its own, so a mask of few feeds
+ * never allocates, the rest in words added as higher feeds are set.
+ * */
+class DynamicFeedMask
+{
+public:
+	inline void set(size_t i) {_word(i >> 6) |= _bit(i);}
+	inline void reset(size_t i)
+	{
+		if((i >> 6) <= _more.size())
+			_word(i >> 6) &= ~_bit(i);
+	}
+	inline bool test(size_t i) const
+	{
+		size_t w = i >> 6;
+		if(w == 0)
+			return (_first & _bit(i)) != 0;
+		return w <= _more.size() && (_more[w-1] & _bit(i)) != 0;
+	}
+
+	// just i
+	inline void only(size_t i)
+	{
+		clear();
+		set(i);
+	}
+
+	// keeps the words, a mask cleared over and over does not allocate again
+	inline void clear()
+	{
+		_first = 0;
+		for(uint64_t& word : _more)
+			word = 0;
+	}
+
+	inline bool none() const
+	{
+		if(_first)
+			return false;
+		for(uint64_t word : _more)
+			if(word)
+				return false;
+		return true;
+	}
+
+	inline unsigned count() const
+	{
+		unsigned n = __builtin_popcountll(_first);
+		for(uint64_t word : _more)
+			n += __builtin_popcountll(word);
+		return n;
+	}
+
+	// calls f(i) for every set i in increasing order
+	template<class F>
+	inline void forEach(F&& f) const
+	{
+		for(uint64_t bits = _first;bits;bits &= bits-1)
+			f(__builtin_ctzll(bits));
+		for(size_t w=0;w<_more.size();w++)
+			for(uint64_t bits = _more[w];bits;bits &= bits-1)
+				f((w+1)*64 + __builtin_ctzll(bits));
+	}
+
+private:
+	static inline uint64_t _bit(size_t i) {return uint64_t(1) << (i & 63);}
+
+	inline uint64_t& _word(size_t w)
+	{
+		if(w == 0)
+			return _first;
+		if(w > _more.size())
+			_more.resize(w, 0);
+		return _more[w-1];
+	}
+
+	uint64_t			  _first{0};
+	std::vector<uint64_t> _more;
+};
+
+#ifdef MDM_MAX_FEEDS
+typedef FeedMaskT<MaxFeeds> FeedMask;
+#else
+typedef DynamicFeedMask FeedMask;
+#endif
+
+#endif
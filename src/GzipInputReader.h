@@ -0,0 +1,176 @@
+#ifndef _GZIPINPUTREADER_H
+#define _GZIPINPUTREADER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <cstring>
+#include <iostream>
+#include <zlib.h>
+#include "InputReader.h"
+#include "Queue.h"
+
+/*
+ * Reads a gzip compressed capture without decompressing it to disk. A helper thread inflates the
+ * file into a small ring of fixed blocks while lines are served out of the block inflated before,
+ * so inflating overlaps with parsing and merging. Lines are views into the block, only a line
+ * which straddles two blocks is copied.
+ * */
+class GzipInputReader : public InputReader
+{
+public:
+	GzipInputReader(const std::string& inputFile, size_t blockSize = 1 << 20, size_t blocks = 4) : _fileName(inputFile)
+	{
+		_file = ::gzopen(_fileName.c_str(), "rb");
+		if(!_file)
+		{
+			_valid = false;
+			return;
+		}
+		::gzbuffer(_file, 256*1024);
+		for(size_t i=0;i<std::max<size_t>(blocks, 2);i++)
+		{
+			_blocks.emplace_back(new Block(blockSize));
+			_free.push(_blocks.back().get());
+		}
+		_inflater = std::thread(&GzipInputReader::_inflating, this);
+
+		//read and drop the first line which is the header
+		std::string_view header;
+		readLineView(header);
+		_entriesRead = 0;
+	}
+	~GzipInputReader()
+	{
+		_free.requestStop();
+		_full.requestStop();
+		if(_inflater.joinable())
+			_inflater.join();
+		if(_file)
+			::gzclose(_file);
+	}
+
+	bool readLine(std::string& line)
+	{
+		std::string_view view;
+		bool res = readLineView(view);
+		line.assign(view.data(), view.size());
+		return res;
+	}
+
+	bool readLineView(std::string_view& line)
+	{
+		line = std::string_view();
+		if(!_valid)
+			return false;
+		_straddling.clear();
+		while(true)
+		{
+			if(_current && _pos < _current->size)
+			{
+				const char* begin = _current->data.get() + _pos;
+				size_t left = _current->size - _pos;
+				const char* nl = static_cast<const char*>(memchr(begin, '\n', left));
+				if(nl)
+				{
+					size_t len = nl - begin;
+					_pos += len + 1;
+					if(_straddling.empty())
+						line = std::string_view(begin, len);
+					else
+					{
+						_straddling.append(begin, len);
+						line = _straddling;
+					}
+					_entriesRead++;
+					return true;
+				}
+				// the line goes on in the next block
+				_straddling.append(begin, left);
+				_pos = _current->size;
+			}
+			if(!_nextBlock())
+				break;
+		}
+		// the last line may have no newline - stay valid while it is handed out, a lazy reader
+		// drops an invalid reader and the line with it
+		if(_straddling.empty())
+		{
+			_valid = false;
+			return false;
+		}
+		line = _straddling;
+		_entriesRead++;
+		return true;
+	}
+
+private:
+	struct Block
+	{
+		Block(size_t capacity_) : data(new char[capacity_]), capacity(capacity_) {}
+
+		std::unique_ptr<char[]> data;
+		size_t					capacity;
+		size_t					size{0};
+	};
+
+	// hands the consumed block back to the inflater, false at the end of the file
+	bool _nextBlock()
+	{
+		if(_current)
+		{
+			_free.push(_current);
+			_current = nullptr;
+		}
+		if(_ended)
+			return false;
+		Block* block{nullptr};
+		if(!_full.pop(block) || !block)
+		{
+			_ended = true;
+			return false;
+		}
+		_current = block;
+		_pos = 0;
+		return true;
+	}
+
+	// a nullptr in the full queue marks the end
+	void _inflating()
+	{
+		Block* block{nullptr};
+		while(_free.pop(block))
+		{
+			int n = ::gzread(_file, block->data.get(), block->capacity);
+			if(n <= 0)
+			{
+				if(n < 0)
+				{
+					int err;
+					std::cerr << "warning: inflating " << _fileName << " failed: " << ::gzerror(_file, &err) << "\n";
+				}
+				_full.push(nullptr);
+				return;
+			}
+			block->size = n;
+			_full.push(block);
+		}
+	}
+
+private:
+	std::string						   _fileName;
+	gzFile							   _file{nullptr};
+	std::vector<std::unique_ptr<Block>> _blocks;
+	BlockingQueue<Block*>			   _free;	// to the inflater
+	BlockingQueue<Block*>			   _full;	// to the reader, in file order
+	std::thread						   _inflater;
+
+	Block*							   _current{nullptr};
+	size_t							   _pos{0};
+	bool							   _ended{false};
+	std::string						   _straddling;	// a line cut by the end of a block
+};
+
+#endif
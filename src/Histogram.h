@@ -0,0 +1,114 @@
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+/*
+ * Log-linear histogram in the HDR style: values below 2^PrecisionBits get a bucket each, above
+ * that every power of two range is cut into 2^(PrecisionBits-1) equal buckets, so a recorded
+ * value is off by less than 1/2^(PrecisionBits-1) of itself. Recording is O(1), the buckets
+ * only grow up to the largest value seen and never beyond the 64 bit range - a few KB at most.
+ * Min, max and the sum are exact.
+ * */
+#ifndef MDM_LATENCY_PRECISION_BITS
+#define MDM_LATENCY_PRECISION_BITS 7
+#endif
+
+class LatencyHistogram
+{
+public:
+	static constexpr unsigned DefaultPrecisionBits = MDM_LATENCY_PRECISION_BITS;
+
+	LatencyHistogram(unsigned precisionBits = DefaultPrecisionBits) : _precisionBits(precisionBits)
+	{
+		if(precisionBits < 1 || precisionBits > 16)
+			throw std::invalid_argument("histogram precision has to be between 1 and 16 bits");
+	}
+
+	void record(uint64_t value)
+	{
+		size_t index = _index(value);
+		if(index >= _counts.size())
+			_counts.resize(index+1, 0);
+		++_counts[index];
+		++_count;
+		_sum += value;
+		_min = std::min(_min, value);
+		_max = std::max(_max, value);
+	}
+
+	// both have to have the same precision
+	void merge(const LatencyHistogram& other)
+	{
+		if(other._precisionBits != _precisionBits)
+			throw std::invalid_argument("merging histograms of different precision");
+		if(other._counts.size() > _counts.size())
+			_counts.resize(other._counts.size(), 0);
+		for(size_t i=0;i<other._counts.size();i++)
+			_counts[i] += other._counts[i];
+		_count += other._count;
+		_sum += other._sum;
+		_min = std::min(_min, other._min);
+		_max = std::max(_max, other._max);
+	}
+
+	uint64_t count() const {return _count;}
+	uint64_t min() const {return _count ? _min : 0;}
+	uint64_t max() const {return _max;}
+	double	 mean() const {return _count ? double(_sum) / _count : 0.0;}
+	unsigned precisionBits() const {return _precisionBits;}
+
+	// the value at or below which percent of the recorded values are, as the top of its bucket
+	// never above the max - 0 when empty
+	uint64_t percentile(double percent) const
+	{
+		if(_count == 0)
+			return 0;
+		uint64_t rank = uint64_t(percent / 100.0 * _count + 0.5);
+		rank = std::min(std::max<uint64_t>(rank, 1), _count);
+		uint64_t seen = 0;
+		for(size_t i=0;i<_counts.size();i++)
+		{
+			seen += _counts[i];
+			if(seen >= rank)
+				return std::min(std::max(_highestEquivalent(i), _min), _max);
+		}
+		return _max;
+	}
+
+	uint64_t p50() const {return percentile(50.0);}
+	uint64_t p90() const {return percentile(90.0);}
+	uint64_t p99() const {return percentile(99.0);}
+	uint64_t p999() const {return percentile(99.9);}
+
+private:
+	inline size_t _index(uint64_t value) const
+	{
+		unsigned msb = value ? 63 - __builtin_clzll(value) : 0;
+		unsigned shift = msb < _precisionBits ? 0 : msb - _precisionBits + 1;
+		return (size_t(shift) << (_precisionBits-1)) + (value >> shift);
+	}
+
+	uint64_t _highestEquivalent(size_t index) const
+	{
+		size_t half = size_t(1) << (_precisionBits-1);
+		size_t shift = index < 2*half ? 0 : index / half - 1;
+		uint64_t base = (index - (shift << (_precisionBits-1))) << shift;
+		uint64_t width = uint64_t(1) << shift;
+		return base + (width - 1);
+	}
+
+private:
+	unsigned		 _precisionBits;
+	std::vector<uint64_t> _counts;
+	uint64_t		 _count{0};
+	uint64_t		 _sum{0};
+	uint64_t		 _min{std::numeric_limits<uint64_t>::max()};
+	uint64_t		 _max{0};
+};
+
+#endif
@@ -2,9 +2,23 @@
 #define _INPUTREADER_H
 #include <fstream>
 #include <string>
+#include <string_view>
+#include <cstring>
+#include <algorithm>
 #include <memory>
 #include <iostream>
 #include <queue>
+#include <functional>
+#include "SymbolTable.h"
+
+#ifdef __unix__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+struct BinaryRecord;
 
 class InputReader
 {
@@ -13,10 +27,30 @@ public:
 	virtual ~InputReader(){}
 	bool isValid() const {return _valid;}
 	virtual bool readLine(std::string&) = 0;
+	// the view is only valid until the next read - readers which can hand out lines
+	// without copying (e.g. memory mapped files) override this
+	virtual bool readLineView(std::string_view& line)
+	{
+		if(!readLine(_lineBuffer))
+		{
+			line = std::string_view();
+			return false;
+		}
+		line = _lineBuffer;
+		return true;
+	}
 	virtual unsigned int numOfEntriesRead() const {return _entriesRead;}
+
+	// readers of the binary format hand out decoded records instead of lines, see BinaryFormat.h
+	// not const, a lazy reader has to open its input to tell
+	virtual bool isBinary() {return false;}
+	// the record is only valid until the next read, its symbol is already interned
+	virtual bool readBinaryRecord(const BinaryRecord*&, SymbolID&) {return false;}
 protected:
 	bool _valid;
 	unsigned int  _entriesRead;
+private:
+	std::string   _lineBuffer;
 };
 
 
@@ -101,9 +135,212 @@ private:
 
 };
 
+#ifdef __unix__
+/*
+ * A read only mapping of a whole file consumed front to back. The kernel is told we read
+ * sequentially and we advise it ahead of the cursor in windows, dropping the pages behind us
+ * so replaying multi-GB captures does not keep them all resident.
+ * */
+class MappedFile
+{
+public:
+	MappedFile(const std::string& file, size_t readAheadWindow) : _window(readAheadWindow)
+	{
+		int fd = ::open(file.c_str(), O_RDONLY);
+		if(fd < 0)
+			return;
+		struct stat st;
+		if(::fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(addr != MAP_FAILED)
+			{
+				_data = static_cast<const char*>(addr);
+				_size = st.st_size;
+				::madvise(addr, _size, MADV_SEQUENTIAL);
+				_adviseReadAhead(0);
+			}
+		}
+		// the mapping stays valid without the descriptor
+		::close(fd);
+	}
+	~MappedFile()
+	{
+		if(_data)
+			::munmap(const_cast<char*>(_data), _size);
+	}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool		isMapped() const {return _data != nullptr;}
+	const char* data() const {return _data;}
+	size_t		size() const {return _size;}
+
+	// everything before pos is consumed
+	inline void consumedUpTo(size_t pos)
+	{
+		if(pos >= _advisedUpTo)
+			_adviseReadAhead(pos);
+	}
+
+private:
+	void _adviseReadAhead(size_t pos)
+	{
+		const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+		// release what is already consumed - we never go back
+		size_t consumed = pos / pageSize * pageSize;
+		if(consumed > _releasedUpTo)
+		{
+			::madvise(const_cast<char*>(_data) + _releasedUpTo, consumed - _releasedUpTo, MADV_DONTNEED);
+			_releasedUpTo = consumed;
+		}
+		size_t start = consumed;
+		size_t end = std::min(_size, start + _window);
+		if(end > start)
+			::madvise(const_cast<char*>(_data) + start, end - start, MADV_WILLNEED);
+		_advisedUpTo = start + _window / 2;
+	}
+
+private:
+	const char*   _data{nullptr};
+	size_t		  _size{0};
+	size_t		  _window;
+	size_t		  _advisedUpTo{0};
+	size_t		  _releasedUpTo{0};
+};
+
+/*
+ * Maps the whole file and hands out views straight into the mapping so reading a line
+ * costs neither a copy nor an allocation.
+ * */
+class MmapFileInputReader : public InputReader
+{
+public:
+	MmapFileInputReader(const std::string& inputFile, size_t readAheadWindow = 16*1024*1024) :
+		_fileName(inputFile), _file(inputFile, readAheadWindow), _pos(0)
+	{
+		if(!_file.isMapped())
+			_valid = false;
+		else
+		{
+			//read and drop the first line which is the header
+			std::string_view header;
+			readLineView(header);
+			_entriesRead = 0;
+		}
+	}
+
+	bool readLine(std::string& line)
+	{
+		std::string_view view;
+		bool res = readLineView(view);
+		line.assign(view.data(), view.size());
+		return res;
+	}
+
+	bool readLineView(std::string_view& line)
+	{
+		if(_pos >= _file.size())
+		{
+			_valid = false;
+			line = std::string_view();
+			return false;
+		}
+
+		const char* begin = _file.data() + _pos;
+		const char* nl = static_cast<const char*>(memchr(begin, '\n', _file.size() - _pos));
+		size_t len = nl ? nl - begin : _file.size() - _pos;
+		line = std::string_view(begin, len);
+		_file.consumedUpTo(_pos);
+		_pos += len + 1;
+		_entriesRead++;
+		return true;
+	}
+
+private:
+	std::string   _fileName;
+	MappedFile	  _file;
+	size_t		  _pos;
+};
+#endif
+
 using InputReaderPtr = std::shared_ptr<InputReader>;
 
 
+/*
+ * Opens the underlying reader on the first read, so that setting up hundreds of feeds
+ * does not hold a descriptor for each of them before the merge gets to it. Once the merge
+ * started a plain or gz: reader holds its descriptor until it runs dry.
+ * */
+class LazyInputReader : public InputReader
+{
+public:
+	using Factory = std::function<InputReaderPtr()>;
+	LazyInputReader(const Factory& factory) : _factory(factory) {}
+
+	bool readLine(std::string& line)
+	{
+		if(!_valid)
+			return false;
+		_open();
+		bool res = _reader->readLine(line);
+		_sync();
+		return res;
+	}
+
+	bool readLineView(std::string_view& line)
+	{
+		if(!_valid)
+		{
+			line = std::string_view();
+			return false;
+		}
+		_open();
+		bool res = _reader->readLineView(line);
+		_sync();
+		return res;
+	}
+
+	bool isBinary()
+	{
+		if(!_valid)
+			return false;
+		_open();
+		return _reader->isBinary();
+	}
+
+	bool readBinaryRecord(const BinaryRecord*& rec, SymbolID& symbol)
+	{
+		if(!_valid)
+			return false;
+		_open();
+		bool res = _reader->readBinaryRecord(rec, symbol);
+		_sync();
+		return res;
+	}
+
+private:
+	void _open()
+	{
+		if(!_reader)
+			_reader = _factory();
+	}
+
+	void _sync()
+	{
+		_valid = _reader->isValid();
+		_entriesRead = _reader->numOfEntriesRead();
+		// nothing more to come, close it
+		if(!_valid)
+			_reader.reset();
+	}
+
+private:
+	Factory		   _factory;
+	InputReaderPtr _reader;
+};
+
+
 
 
 #endif
@@ -1,66 +1,389 @@
 #ifndef _LOGGER_
 #define _LOGGER_
 
-#include "Queue.h"
+#include "SPSCRingBuffer.h"
+#include "ThreadPlacement.h"
+#include "TscClock.h"
+#include "OutputSink.h"
 #include <thread>
 #include <atomic>
-#include <fstream>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <type_traits>
 
+/*
+ * Asynchronous logger for the hot paths. The call site only copies its arguments, tagged by type,
+ * behind a TSC timestamp and the id of its format string into a fixed size entry of its thread's
+ * own ring - no lock, no allocation and no formatting. The logger thread collects the entries of
+ * every thread, puts each batch in time order, substitutes the {} in the format with the arguments
+ * and writes them out in large batches, flushing whenever it runs out of entries. A thread's
+ * entries stay in its order, across threads an entry stamped just before a drain may show up in
+ * the next batch.
+ * A full ring drops the entry and counts it, logging never holds up the caller. Strings longer
+ * than an entry has room for are cut.
+ * Log through the LOG_DEBUG/LOG_INFO/LOG_WARN macros, they register the format once per call
+ * site and skip the entry altogether below the logger's level.
+ * */
 class Logger
 {
 public:
-	Logger(std::string file) : _logFile(file, std::ofstream::out)
+	enum class Level : uint8_t
 	{
+		Debug,
+		Info,
+		Warning
+	};
+
+	static constexpr size_t EntrySize = 256;
+	static constexpr size_t DefaultRingCapacity = 1024;		// entries per thread
+
+	Logger(std::string file, Level level = Level::Info, size_t ringCapacity = DefaultRingCapacity) : _level(level),
+																								  _ringCapacity(ringCapacity),
+																								  _id(_nextId().fetch_add(1)),
+																								  _startTicks(TscClock::now())
+	{
+		// constructed before the logger, so the registry outlives a logger with static storage
+		_registry();
+		try
+		{
+			_out.reset(new BufferedOutput(file));
+		}
+		catch(const std::invalid_argument& e)
+		{
+			std::cerr << "warning: logging is off: " << e.what() << "\n";
+		}
 		_flusherThread = std::thread(&Logger::processing, this);
 	}
 	~Logger()
 	{
-		_queue.requestStop();
+		_stopRequested.store(true, std::memory_order_release);
 		if(_flusherThread.joinable())
 			_flusherThread.join();
-		_logFile.flush();
-		_logFile.close();
 	}
 
-	inline void log(const std::string& msg)
+	inline bool enabled(Level level) const {return level >= _level.load(std::memory_order_relaxed);}
+	void setLevel(Level level) {_level.store(level, std::memory_order_relaxed);}
+
+	// the id of a format string, which has to outlive the logger - a literal
+	static uint32_t registerFormat(const char* format)
+	{
+		FormatRegistry& registry = _registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		registry.formats.push_back(format);
+		return registry.formats.size() - 1;
+	}
+
+	template<class... Args>
+	inline void write(Level level, uint32_t format, const Args&... args)
 	{
-		_queue.push(msg);
+		if(!_producer().ring.tryEmplace(level, format, args...))
+			_producer().dropped.fetch_add(1, std::memory_order_relaxed);
 	}
 
-	inline void operator()(const std::string& msg)
+	inline void log(std::string_view msg)
+	{
+		static const uint32_t plain = registerFormat("{}");
+		write(Level::Info, plain, msg);
+	}
+
+	inline void operator()(std::string_view msg)
 	{
 		log(msg);
 	}
 
+	bool place(const ThreadPlacement& placement)
+	{
+		return placement.apply(_flusherThread.native_handle(), "logger");
+	}
+
+	// entries of threads with a full ring, so far
+	size_t droppedCount() const
+	{
+		std::lock_guard<std::mutex> lock(_producersMutex);
+		size_t dropped = _droppedOfRetired;
+		for(const auto& producer : _producers)
+			dropped += producer->dropped.load(std::memory_order_relaxed);
+		return dropped;
+	}
+
 private:
+	enum ArgType : uint8_t {Signed, Unsigned, Floating, Text};
+
+	/*
+	 * One call's timestamp, format and arguments, each argument a type byte and its value
+	 * - 8 bytes for numbers, a 2 byte length and the bytes for strings.
+	 * */
+	struct Entry
+	{
+		Entry() {}
+		template<class... Args>
+		Entry(Level level_, uint32_t format_, const Args&... args) : ticks(TscClock::now()), format(format_), level(level_)
+		{
+			(_append(args), ...);
+		}
+
+		TscClock::Ticks ticks{0};
+		uint32_t		format{0};
+		Level			level{Level::Info};
+		uint8_t			argCount{0};
+		uint16_t		size{0};
+		char			args[EntrySize - 16];
+
+	private:
+		template<class T>
+		void _append(const T& arg)
+		{
+			if constexpr(std::is_same<T, bool>::value)
+				_appendNumber(Unsigned, uint64_t(arg));
+			else if constexpr(std::is_integral<T>::value && std::is_signed<T>::value)
+				_appendNumber(Signed, int64_t(arg));
+			else if constexpr(std::is_integral<T>::value || std::is_enum<T>::value)
+				_appendNumber(Unsigned, uint64_t(arg));
+			else if constexpr(std::is_floating_point<T>::value)
+				_appendNumber(Floating, double(arg));
+			else
+				_appendText(std::string_view(arg));
+		}
+
+		template<class T>
+		void _appendNumber(ArgType type, T value)
+		{
+			if(size + 1 + sizeof(value) > sizeof(args))
+				return;
+			args[size++] = type;
+			memcpy(args + size, &value, sizeof(value));
+			size += sizeof(value);
+			++argCount;
+		}
+
+		void _appendText(std::string_view text)
+		{
+			if(size_t(size) + 3 > sizeof(args))
+				return;
+			uint16_t length = std::min(text.size(), sizeof(args) - size - 3);
+			args[size++] = Text;
+			memcpy(args + size, &length, sizeof(length));
+			memcpy(args + size + sizeof(length), text.data(), length);
+			size += sizeof(length) + length;
+			++argCount;
+		}
+	};
+	static_assert(sizeof(Entry) == EntrySize, "Entry layout");
+
+	struct Producer
+	{
+		Producer(size_t capacity) : ring(capacity) {}
+
+		SPSCRingBuffer<Entry> ring;
+		std::atomic<size_t>	  dropped{0};
+		std::atomic<bool>	  retired{false};		// its thread is gone, freed once drained
+	};
+
+	// the calling thread's ring, registered with the logger on its first entry
+	Producer& _producer()
+	{
+		struct Registration
+		{
+			uint64_t				  logger;
+			std::shared_ptr<Producer> producer;
+		};
+		struct ThreadProducers
+		{
+			std::vector<Registration> registrations;
+			~ThreadProducers()
+			{
+				for(auto& r : registrations)
+					r.producer->retired.store(true, std::memory_order_release);
+			}
+		};
+		thread_local ThreadProducers mine;
+		for(auto& r : mine.registrations)
+			if(r.logger == _id)
+				return *r.producer;
+
+		std::shared_ptr<Producer> producer = std::make_shared<Producer>(_ringCapacity);
+		{
+			std::lock_guard<std::mutex> lock(_producersMutex);
+			_producers.push_back(producer);
+		}
+		mine.registrations.push_back(Registration{_id, producer});
+		return *producer;
+	}
 
 	void processing()
 	{
+		std::vector<Entry> batch;
+		std::string line;
+		size_t reportedDropped = 0;
 		while(true)
 		{
-			std::string msg;
-			int c = 0;
-			if(_queue.pop(msg))
+			bool stopping = _stopRequested.load(std::memory_order_acquire);
+			_collect(batch);
+			if(!batch.empty())
 			{
-				_logFile << msg << "\n";
-				if(++c >= _flushAfterCountMsg)
+				// every ring is in order, across threads the timestamps decide
+				std::stable_sort(batch.begin(), batch.end(), [](const Entry& a, const Entry& b){return a.ticks < b.ticks;});
+				for(const Entry& entry : batch)
 				{
-					_logFile.flush();
-					c = 0;
+					_format(entry, line);
+					if(_out)
+						_out->append(line.data(), line.size());
 				}
+				batch.clear();
+				continue;
 			}
-			else
+			size_t dropped = droppedCount();
+			if(dropped != reportedDropped && _out)
+			{
+				line = "log entries dropped, rings full: " + std::to_string(dropped - reportedDropped) + "\n";
+				_out->append(line.data(), line.size());
+				reportedDropped = dropped;
+			}
+			if(_out)
+				_out->flush();
+			if(stopping)
 				break;
+			std::this_thread::sleep_for(IdleSleep);
+		}
+	}
+
+	void _collect(std::vector<Entry>& batch)
+	{
+		std::lock_guard<std::mutex> lock(_producersMutex);
+		for(auto it = _producers.begin();it != _producers.end();)
+		{
+			Producer& producer = **it;
+			// retired before the drain, so nothing can follow it
+			bool retired = producer.retired.load(std::memory_order_acquire);
+			Entry entry;
+			for(size_t n=0;n < BatchSize && producer.ring.tryPop(entry);n++)
+				batch.push_back(entry);
+			if(retired && producer.ring.size() == 0)
+			{
+				_droppedOfRetired += producer.dropped.load(std::memory_order_relaxed);
+				it = _producers.erase(it);
+			}
+			else
+				++it;
+		}
+	}
+
+	void _format(const Entry& entry, std::string& line) const
+	{
+		static const char* levels[] = {"DEBUG", "INFO", "WARN"};
+		char buff[64];
+		uint64_t micros = TscClock::nanosBetween(_startTicks, entry.ticks) / 1000;
+		snprintf(buff, sizeof(buff), "%llu.%06llu %s ", (unsigned long long)(micros / 1000000), (unsigned long long)(micros % 1000000), levels[size_t(entry.level)]);
+		line = buff;
+
+		const char* format;
+		{
+			FormatRegistry& registry = _registry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			format = registry.formats[entry.format];
+		}
+		size_t pos = 0;
+		uint8_t arg = 0;
+		for(const char* c = format;*c;c++)
+		{
+			if(c[0] == '{' && c[1] == '}' && arg < entry.argCount)
+			{
+				pos = _appendArg(entry, pos, line);
+				++arg;
+				++c;
+			}
+			else
+				line += *c;
+		}
+		line += '\n';
+	}
+
+	// the argument at pos as text, returns the position of the next one
+	static size_t _appendArg(const Entry& entry, size_t pos, std::string& line)
+	{
+		char buff[32];
+		ArgType type = ArgType(entry.args[pos++]);
+		if(type == Text)
+		{
+			uint16_t length;
+			memcpy(&length, entry.args + pos, sizeof(length));
+			line.append(entry.args + pos + sizeof(length), length);
+			return pos + sizeof(length) + length;
+		}
+		uint64_t bits;
+		memcpy(&bits, entry.args + pos, sizeof(bits));
+		if(type == Signed)
+			snprintf(buff, sizeof(buff), "%lld", (long long)int64_t(bits));
+		else if(type == Unsigned)
+			snprintf(buff, sizeof(buff), "%llu", (unsigned long long)bits);
+		else
+		{
+			double value;
+			memcpy(&value, &bits, sizeof(value));
+			snprintf(buff, sizeof(buff), "%g", value);
 		}
+		line += buff;
+		return pos + sizeof(bits);
+	}
+
+	// format ids are shared by every logger, a call site registers its format once
+	struct FormatRegistry
+	{
+		std::mutex				mutex;
+		std::deque<const char*> formats;
+	};
 
+	static FormatRegistry& _registry()
+	{
+		static FormatRegistry registry;
+		return registry;
+	}
+
+	static std::atomic<uint64_t>& _nextId()
+	{
+		static std::atomic<uint64_t> id{0};
+		return id;
 	}
 
 private:
-	BlockingQueue<std::string> _queue;
+	static constexpr size_t BatchSize = 4096;
+	static constexpr std::chrono::milliseconds IdleSleep{1};
+
+	std::atomic<Level>		   _level;
+	size_t					   _ringCapacity;
+	uint64_t				   _id;
+	TscClock::Ticks			   _startTicks;
+	std::unique_ptr<BufferedOutput> _out;
+	mutable std::mutex		   _producersMutex;
+	std::vector<std::shared_ptr<Producer>> _producers;
+	size_t					   _droppedOfRetired{0};
+	std::atomic<bool>		   _stopRequested{false};
 	std::thread				   _flusherThread;
-	std::ofstream 			   _logFile;
-	const int				   _flushAfterCountMsg{10};
 };
 
+// defined by every program
+extern Logger LOG;
+
+#define MDM_LOG(logger, level, format, ...) \
+	do \
+	{ \
+		if((logger).enabled(level)) \
+		{ \
+			static const uint32_t _mdmLogFormat = Logger::registerFormat(format); \
+			(logger).write(level, _mdmLogFormat, ##__VA_ARGS__); \
+		} \
+	} while(0)
+
+#define LOG_DEBUG(format, ...) MDM_LOG(LOG, Logger::Level::Debug, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) MDM_LOG(LOG, Logger::Level::Info, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) MDM_LOG(LOG, Logger::Level::Warning, format, ##__VA_ARGS__)
+
 #endif
@@ -0,0 +1,120 @@
+#ifndef _MPSCRINGBUFFER_H
+#define _MPSCRINGBUFFER_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include "Backoff.h"
+
+/*
+ * Bounded multi producer single consumer ring in the Disruptor style, capacity rounded up to a
+ * power of two of at least 2. A producer claims the next sequence with one fetch_add, writes the element in
+ * place in the preallocated slot and publishes it by advancing the slot's own sequence - no lock
+ * and no allocation, producers only contend on the claim counter. The consumer reads the slots in
+ * sequence order once they are published and hands each back by moving its sequence one lap on.
+ * A producer which finds the ring full waits with a backoff for the consumer.
+ * Follows the BlockingQueue protocol: pop fails once a stop was requested and nothing is left,
+ * nothing may be published after the stop.
+ * */
+template<class T>
+class MPSCRingBuffer
+{
+public:
+	static constexpr size_t CacheLine = 64;
+
+	MPSCRingBuffer(size_t capacity) : _capacity(_roundUp(capacity)), _mask(_capacity-1), _slots(new Slot[_capacity])
+	{
+		for(size_t i=0;i<_capacity;i++)
+			_slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	MPSCRingBuffer(const MPSCRingBuffer&) = delete;
+	MPSCRingBuffer& operator=(const MPSCRingBuffer&) = delete;
+
+	// write(T&) fills the claimed slot in place, any thread
+	template<class F>
+	void publish(F&& write)
+	{
+		size_t sequence = _claimed.value.fetch_add(1, std::memory_order_relaxed);
+		Slot& slot = _slots[sequence & _mask];
+		Backoff backoff;
+		while(slot.sequence.load(std::memory_order_acquire) != sequence)
+			backoff.pause();
+		write(slot.value);
+		slot.sequence.store(sequence+1, std::memory_order_release);
+	}
+
+	void push(const T& val) {publish([&val](T& slot){slot = val;});}
+
+	// consumer side: calls read(const T&) on up to max published elements in sequence order,
+	// returns how many - never waits
+	template<class F>
+	size_t consume(F&& read, size_t max)
+	{
+		size_t count = 0;
+		for(;count < max;count++)
+		{
+			Slot& slot = _slots[_next & _mask];
+			if(slot.sequence.load(std::memory_order_acquire) != _next+1)
+				break;
+			read(static_cast<const T&>(slot.value));
+			// free for the producer one lap ahead
+			slot.sequence.store(_next + _capacity, std::memory_order_release);
+			++_next;
+		}
+		return count;
+	}
+
+	bool tryPop(T& val) {return consume([&val](const T& slot){val = slot;}, 1) == 1;}
+
+	// waits with a backoff, false once stopped and empty
+	bool pop(T& val)
+	{
+		Backoff backoff;
+		while(!tryPop(val))
+		{
+			if(_stopRequested.load(std::memory_order_acquire) && isEmpty())
+				return tryPop(val);
+			backoff.pause();
+		}
+		return true;
+	}
+
+	void requestStop() {_stopRequested.store(true, std::memory_order_release);}
+	bool stopRequested() const {return _stopRequested.load(std::memory_order_acquire);}
+
+	// consumer side: nothing claimed beyond what was consumed
+	bool isEmpty() const {return _claimed.value.load(std::memory_order_acquire) == _next;}
+
+	size_t capacity() const {return _capacity;}
+
+private:
+	struct alignas(CacheLine) Slot
+	{
+		std::atomic<size_t> sequence;		// == its sequence: free, == sequence+1: published
+		T					value{};
+	};
+
+	struct alignas(CacheLine) Counter
+	{
+		std::atomic<size_t> value{0};
+	};
+
+	// one slot could not tell published (sequence+1) from free for the next lap (sequence+capacity)
+	static size_t _roundUp(size_t n)
+	{
+		size_t capacity = 2;
+		while(capacity < n)
+			capacity <<= 1;
+		return capacity;
+	}
+
+private:
+	const size_t			 _capacity;
+	const size_t			 _mask;
+	std::unique_ptr<Slot[]>	 _slots;
+	Counter					 _claimed;
+	alignas(CacheLine) size_t _next{0};	// consumer only
+	std::atomic<bool>		 _stopRequested{false};
+};
+
+#endif
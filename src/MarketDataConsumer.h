@@ -2,9 +2,15 @@
 #define _MARKETDATACONSUMER_H
 
 #include <vector>
-#include "SpinningQueue.h"
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include "SPSCRingBuffer.h"
 #include "Reporter.h"
 #include "BookGroupProcessor.h"
+#include "ThreadPlacement.h"
+#include "Partitioner.h"
+#include "Rebalancer.h"
 #include "Book.h"
 #include "Record.h"
 
@@ -13,13 +19,30 @@ using namespace std;
 class MarketDataConsumer
 {
 public:
-	MarketDataConsumer(int numOfProcessors, const ReporterPtr& reporter) : _numOfProcessors(numOfProcessors),
+	/*
+	 * Multiplexed: push() queues the record for the multiplexer thread which hands it on to the processor.
+	 * Direct: push() routes the record straight into the processor's queue on the calling (feed) thread,
+	 * one thread hop and one queue less on the way to the book.
+	 * */
+	enum class Routing
+	{
+		Multiplexed,
+		Direct
+	};
+
+	MarketDataConsumer(int numOfProcessors, const ReporterPtr& reporter, Routing routing = Routing::Multiplexed,
+						const ThreadLayout& layout = ThreadLayout()) : _numOfProcessors(numOfProcessors),
+																	_routing(routing),
+																	_layout(layout),
+																	_partition(numOfProcessors),
 																	_feedEnded(false),
-																	_processorPool(numOfProcessors),
 																	_reporter(reporter)
 	{
-		for(size_t i=0;i<_processorPool.size();i++)
-			_processorPool[i].registerReporter(reporter);
+		for(int i=0;i<numOfProcessors;i++)
+		{
+			_processorPool.emplace_back(new BookGroupProcessor(layout.processor(i)));
+			_processorPool[i]->registerReporter(reporter);
+		}
 
 	}
 	~MarketDataConsumer()
@@ -29,31 +52,98 @@ public:
 
 
 
+	// watch the processors and move symbols off one which stays overloaded, has to be called before start
+	void enableRebalancer(chrono::milliseconds period)
+	{
+		_rebalancePeriod = period;
+		_rebalancer.reset(new Rebalancer(_numOfProcessors, _processorPool[0]->queueCapacity(),
+			[this](int i){return Rebalancer::Sample{_processorPool[i]->queueDepth(), _processorPool[i]->busyNanos()};},
+			[this](int from, int to){requestRebalance(from, to);}));
+	}
+
 	void start()
 	{
-		_multiplexerThread = std::thread(&MarketDataConsumer::multiplexer, this);
+		if(_rebalancer)
+			_rebalancer->start(_rebalancePeriod);
+		if(_routing == Routing::Multiplexed)
+			_multiplexerThread = std::thread(&MarketDataConsumer::multiplexer, this);
 	}
 
+	// a nullptr marks the end of the feeds
 	void push(const RecordPtr& rec)
 	{
-		_incomingRecordsQueue.push(rec);
+		if(rec)
+			rec->stamp(Stage::Merged);
+		if(_routing == Routing::Direct)
+			route(rec);
+		else
+			_incomingRecordsQueue.push(rec);
+	}
+
+	Routing routing() const {return _routing;}
+
+	// which processor gets which symbol, has to be set before start - by default symbol id modulo processor count
+	void setPartition(const SymbolPartition& partition)
+	{
+		if(partition.processors() != _numOfProcessors)
+			throw invalid_argument("partition is for " + to_string(partition.processors()) + " processors");
+		_partition = partition;
+	}
+	const SymbolPartition& partition() const {return _partition;}
+
+	// records each processor handled, after join
+	vector<size_t> getProcessorMessageCounts() const
+	{
+		vector<size_t> counts;
+		for(const auto& p : _processorPool)
+			counts.push_back(p->messageCount());
+		return counts;
+	}
+
+	// per processor, after join
+	vector<StageLatencies> getStageLatencies() const
+	{
+		vector<StageLatencies> latencies;
+		for(const auto& p : _processorPool)
+			latencies.push_back(p->stageLatencies());
+		return latencies;
 	}
 
 	void feedEnded(){/*TODO*/}
 
 
+	// thread safe, the symbol's book and statistics move to the processor with the next routed record
+	void requestMigration(SymbolID symbol, int to)
+	{
+		_request(MigrationRequest{symbol, -1, to});
+	}
+
+	// thread safe, moves the symbol which evens out the two processors' recent load best
+	void requestRebalance(int from, int to)
+	{
+		_request(MigrationRequest{InvalidSymbolID, from, to});
+	}
+
+	// read after join
+	size_t migrationCount() const {return _migrations.size();}
+
+	// returns once every processor has finished, the statistics are ready then
 	void join()
 	{
 		if(_multiplexerThread.joinable())
 			_multiplexerThread.join();
+		for(auto& p : _processorPool)
+			p->join();
+		if(_rebalancer)
+			_rebalancer->stop();
 	}
 
-	unordered_map<string, BookStatistics> getBookStatistics()
+	unordered_map<SymbolID, BookStatistics> getBookStatistics()
 	{
-		unordered_map<string, BookStatistics> stats;
+		unordered_map<SymbolID, BookStatistics> stats;
 		for(const auto& procpool : _processorPool)
 		{
-			const unordered_map<string, BookStatistics>& bs = procpool.bookStats();
+			const unordered_map<SymbolID, BookStatistics>& bs = procpool->bookStats();
 			for(const auto& p : bs)
 			{
 				stats.insert(p);
@@ -63,51 +153,179 @@ public:
 		return std::move(stats);
 	}
 
+	// top of book update latencies of all the symbols
+	LatencyHistogram getLatencies()
+	{
+		LatencyHistogram latencies;
+		for(const auto& procpool : _processorPool)
+			for(const auto& p : procpool->bookStats())
+				latencies.merge(p.second.Latencies());
+		return latencies;
+	}
+
 private:
 	void multiplexer()
 	{
-		while(true)
+		_layout.multiplexer().applyToCurrentThread("multiplexer");
+		vector<RecordPtr> batch;
+		batch.reserve(BatchSize);
+		// records headed to each processor, sent together once the batch is sorted out
+		vector<vector<RecordPtr>> perProcessor(_processorPool.size());
+		for(auto& out : perProcessor)
+			out.reserve(BatchSize);
+
+		bool ended = false;
+		while(!ended && _incomingRecordsQueue.drainTo(batch, BatchSize) > 0)
 		{
-			RecordPtr record{nullptr};
-			if(_incomingRecordsQueue.pop(record))
+			TscClock::Ticks routed = TscClock::now();
+			for(const RecordPtr& record : batch)
 			{
-				if(record)
-					multiplex(record);
-				else
+				if(!record)
+				{
+					ended = true;
 					break;
+				}
+				record->stamp(Stage::Routed, routed);
+				_count(record->Symbolid());
+				perProcessor[_partition.processorOf(record->Symbolid())].push_back(record);
 			}
-			else
-				break;
+			batch.clear();
+
+			for(size_t i=0;i<perProcessor.size();i++)
+			{
+				_processorPool[i]->sendBatch(perProcessor[i].begin(), perProcessor[i].end());
+				perProcessor[i].clear();
+			}
+			// between batches, everything routed so far is in the processors' queues
+			if(!ended && _requestsPending.load(std::memory_order_acquire))
+				_applyRequests();
 		}
 		for(auto& p : _processorPool)
 		{
-			p.send(nullptr);
+			p->send(nullptr);
 		}
 		_feedEnded = true;
 	}
 
-	inline void multiplex(const RecordPtr& record)
+	void route(const RecordPtr& record)
 	{
-		size_t bucket = hash(record->Symbol(), _numOfProcessors);
-		_processorPool[bucket].send(record);
+		if(record)
+		{
+			if(_requestsPending.load(std::memory_order_acquire))
+				_applyRequests();
+			_count(record->Symbolid());
+			_processorPool[_partition.processorOf(record->Symbolid())]->send(record);
+		}
+		else
+		{
+			for(auto& p : _processorPool)
+				p->send(nullptr);
+			_feedEnded = true;
+		}
 	}
 
-	// we might do different load balancing - especially if we know that certain symbols are very traffic heavy
-	inline unsigned int hash(const std::string& symbolName, int bucketCount) const
+	struct MigrationRequest
 	{
-		return _hasher(symbolName) % bucketCount;
+		SymbolID symbol;	// InvalidSymbolID: pick one on from
+		int		 from;
+		int		 to;
+	};
+
+	void _request(const MigrationRequest& request)
+	{
+		std::lock_guard<std::mutex> lock(_requestsMutex);
+		_requests.push_back(request);
+		_requestsPending.store(true, std::memory_order_release);
 	}
 
+	// router side: the routing table is only ever changed here
+	void _applyRequests()
+	{
+		vector<MigrationRequest> requests;
+		{
+			std::lock_guard<std::mutex> lock(_requestsMutex);
+			requests.swap(_requests);
+			_requestsPending.store(false, std::memory_order_relaxed);
+		}
+		for(const MigrationRequest& request : requests)
+		{
+			SymbolID symbol = request.symbol;
+			if(symbol == InvalidSymbolID)
+				symbol = _pickSymbol(request.from, request.to);
+			if(symbol != InvalidSymbolID)
+				_migrate(symbol, request.to);
+		}
+	}
 
+	void _migrate(SymbolID symbol, int to)
+	{
+		int from = _partition.processorOf(symbol);
+		if(to < 0 || to >= _numOfProcessors || to == from)
+			return;
+		_migrations.emplace_back(new Migration(symbol));
+		Migration* migration = _migrations.back().get();
+		_processorPool[from]->send(ProcessorMessage(migration, ProcessorMessage::MigrateOut));
+		_partition.assign(symbol, to);
+		_processorPool[to]->send(ProcessorMessage(migration, ProcessorMessage::MigrateIn));
+	}
+
+	// the symbol on from whose records since the last rebalance come closest to half the difference
+	// between the two processors, never the only busy symbol of from - that would just move the hot spot
+	SymbolID _pickSymbol(int from, int to)
+	{
+		double fromLoad = 0, toLoad = 0;
+		for(SymbolID s=0;s<_recentCounts.size();s++)
+		{
+			int p = _partition.processorOf(s);
+			if(p == from)
+				fromLoad += _recentCounts[s];
+			else if(p == to)
+				toLoad += _recentCounts[s];
+		}
+		double target = (fromLoad - toLoad) / 2;
+		SymbolID best = InvalidSymbolID;
+		for(SymbolID s=0;s<_recentCounts.size();s++)
+		{
+			if(_recentCounts[s] == 0 || _recentCounts[s] >= fromLoad || _partition.processorOf(s) != from)
+				continue;
+			if(best == InvalidSymbolID || abs(_recentCounts[s] - target) < abs(_recentCounts[best] - target))
+				best = s;
+		}
+		std::fill(_recentCounts.begin(), _recentCounts.end(), 0);
+		return best;
+	}
+
+	// records per symbol since the last rebalance, only kept with the rebalancer on
+	inline void _count(SymbolID symbol)
+	{
+		if(!_rebalancer)
+			return;
+		if(symbol >= _recentCounts.size())
+			_recentCounts.resize(symbol+1, 0);
+		++_recentCounts[symbol];
+	}
 
 private:
+	static constexpr size_t BatchSize = 256;
+
 	int													_numOfProcessors;
+	Routing												_routing;
+	ThreadLayout										_layout;
+	SymbolPartition										_partition;
 	bool					 							_feedEnded;
-	SpinningQueue<RecordPtr> 							_incomingRecordsQueue;
-	vector<BookGroupProcessor> 		 		 			_processorPool;
+	SPSCRingBuffer<RecordPtr> 							_incomingRecordsQueue{1 << 16};
+	vector<unique_ptr<BookGroupProcessor>> 		 		_processorPool;
 	thread					 							_multiplexerThread;
-	std::hash<std::string>								_hasher;
 	ReporterPtr											_reporter;
+
+	// migrations, the router's side apart from the requests
+	std::mutex											_requestsMutex;
+	vector<MigrationRequest>							_requests;
+	std::atomic<bool>									_requestsPending{false};
+	vector<unique_ptr<Migration>>						_migrations;	// the processors point at them until the end
+	vector<double>										_recentCounts;
+	unique_ptr<Rebalancer>								_rebalancer;
+	chrono::milliseconds								_rebalancePeriod{0};
 };
 
 
@@ -0,0 +1,76 @@
+#ifndef _NUMBERPARSER_H
+#define _NUMBERPARSER_H
+
+#include <string_view>
+#include <cstdint>
+#include <limits>
+#include "Price.h"
+
+/*
+ * Parsers for the numeric market data columns working on character ranges.
+ * Unlike stod/stoi they do not look at the locale, do not throw and do not need a
+ * null terminated string - they return false on anything malformed.
+ * */
+namespace NumberParser
+{
+
+inline bool isDigit(char c) {return static_cast<unsigned char>(c - '0') < 10;}
+
+inline bool parseUnsigned(std::string_view s, unsigned int& out)
+{
+	if(s.empty() || s.size() > 10)
+		return false;
+	uint64_t val = 0;
+	for(char c : s)
+	{
+		if(!isDigit(c))
+			return false;
+		val = val * 10 + (c - '0');
+	}
+	if(val > std::numeric_limits<unsigned int>::max())
+		return false;
+	out = static_cast<unsigned int>(val);
+	return true;
+}
+
+// fixed point decimal, e.g. 205.24 or 39.2, into integer ticks of the configured scale
+// more decimals than the scale can represent are rejected rather than rounded
+inline bool parsePrice(std::string_view s, Price& out)
+{
+	// fast path for the most common shape ddd.dd
+	if(PriceDecimals >= 2 && s.size() == 6 && s[3] == '.' && isDigit(s[0]) && isDigit(s[1]) && isDigit(s[2]) && isDigit(s[4]) && isDigit(s[5]))
+	{
+		Price mantissa = (s[0]-'0')*10000 + (s[1]-'0')*1000 + (s[2]-'0')*100 + (s[4]-'0')*10 + (s[5]-'0');
+		out = mantissa * pow10Price(PriceDecimals >= 2 ? PriceDecimals - 2 : 0);
+		return true;
+	}
+
+	size_t i = 0;
+	bool negative = false;
+	if(i < s.size() && s[i] == '-')
+	{
+		negative = true;
+		++i;
+	}
+	Price mantissa = 0;
+	size_t intDigits = 0;
+	for(;i < s.size() && isDigit(s[i]);++i, ++intDigits)
+		mantissa = mantissa * 10 + (s[i] - '0');
+	int decimals = 0;
+	if(i < s.size() && s[i] == '.')
+	{
+		++i;
+		for(;i < s.size() && isDigit(s[i]);++i, ++decimals)
+			mantissa = mantissa * 10 + (s[i] - '0');
+	}
+	// 18 digits of ticks always fit an int64
+	if(i != s.size() || intDigits + decimals == 0 || intDigits + PriceDecimals > 18 || decimals > PriceDecimals)
+		return false;
+	mantissa *= pow10Price(PriceDecimals - decimals);
+	out = negative ? -mantissa : mantissa;
+	return true;
+}
+
+}
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef _OUTPUTSINK_H
+#define _OUTPUTSINK_H
+
+#include <string>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Price.h"
+#include "TimePoint.h"
+#include "SymbolTable.h"
+
+using namespace std;
+
+/*
+ * Text formatting straight into a caller's buffer, no allocation and no locale. Each returns the
+ * end of what it wrote.
+ * */
+namespace TextFormat
+{
+	constexpr size_t MaxUnsigned = 20;
+	constexpr size_t MaxPrice = 21 + PriceDecimals;		// sign, 19 digits, the point
+	constexpr size_t MaxTime = 18;						// HH:MM:SS.nnnnnnnnn
+
+	inline char* appendUnsigned(char* out, uint64_t value)
+	{
+		char digits[MaxUnsigned];
+		size_t n = 0;
+		do
+		{
+			digits[n++] = '0' + value % 10;
+			value /= 10;
+		} while(value);
+		while(n)
+			*out++ = digits[--n];
+		return out;
+	}
+
+	// every decimal of the tick without trailing zeros, no point for a whole price
+	inline char* appendPrice(char* out, Price price)
+	{
+		uint64_t magnitude = price;
+		if(price < 0)
+		{
+			*out++ = '-';
+			magnitude = 0 - magnitude;
+		}
+		out = appendUnsigned(out, magnitude / PriceScale);
+		uint64_t fraction = magnitude % PriceScale;
+		if(fraction == 0)
+			return out;
+		int decimals = PriceDecimals;
+		while(fraction % 10 == 0)
+		{
+			fraction /= 10;
+			--decimals;
+		}
+		*out++ = '.';
+		for(int i=decimals-1;i>=0;i--)
+		{
+			out[i] = '0' + fraction % 10;
+			fraction /= 10;
+		}
+		return out + decimals;
+	}
+
+	inline char* _twoDigits(char* out, int value)
+	{
+		out[0] = '0' + value / 10;
+		out[1] = '0' + value % 10;
+		return out + 2;
+	}
+
+	// the same as TimePoint::toString
+	inline char* appendTime(char* out, const TimePoint& time)
+	{
+		out = _twoDigits(out, time.hr());
+		*out++ = ':';
+		out = _twoDigits(out, time.min());
+		*out++ = ':';
+		out = _twoDigits(out, time.sec());
+		*out++ = '.';
+		int64_t subSecond = time.nanos() % TimePoint::NanosPerSecond;
+		int decimals = 9;
+		if(subSecond % 1000000 == 0)
+		{
+			subSecond /= 1000000;
+			decimals = 3;
+		}
+		else if(subSecond % 1000 == 0)
+		{
+			subSecond /= 1000;
+			decimals = 6;
+		}
+		for(int i=decimals-1;i>=0;i--)
+		{
+			out[i] = '0' + subSecond % 10;
+			subSecond /= 10;
+		}
+		return out + decimals;
+	}
+}
+
+/*
+ * Collects output in one large buffer and hands it to the file descriptor with a single write
+ * once full, so the per line cost is a memcpy. "-" is stdout. A failed write is reported once on
+ * cerr and the rest of the output is dropped.
+ * */
+class BufferedOutput
+{
+public:
+	static constexpr size_t DefaultBufferSize = 1 << 20;
+
+	BufferedOutput(const string& file, size_t bufferSize = DefaultBufferSize) : _name(file == "-" ? "stdout" : file),
+																			  _buffer(new char[bufferSize]),
+																			  _capacity(bufferSize)
+	{
+		if(file == "-")
+			_fd = STDOUT_FILENO;
+		else
+		{
+			_fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if(_fd < 0)
+				throw invalid_argument("cannot write output to " + file + ": " + strerror(errno));
+			_owned = true;
+		}
+	}
+	~BufferedOutput()
+	{
+		flush();
+		if(_owned)
+			::close(_fd);
+	}
+	BufferedOutput(const BufferedOutput&) = delete;
+	BufferedOutput& operator=(const BufferedOutput&) = delete;
+
+	// room for at least n more bytes, flushes to make it - n has to fit the buffer
+	inline char* reserve(size_t n)
+	{
+		if(_capacity - _size < n)
+			flush();
+		return _buffer.get() + _size;
+	}
+
+	// what was written since reserve, up to end
+	inline void commit(char* end) {_size = end - _buffer.get();}
+
+	void append(const char* data, size_t n)
+	{
+		if(n > _capacity)
+		{
+			flush();
+			_write(data, n);
+			return;
+		}
+		memcpy(reserve(n), data, n);
+		_size += n;
+	}
+
+	void flush()
+	{
+		_write(_buffer.get(), _size);
+		_size = 0;
+	}
+
+	size_t bytesWritten() const {return _written;}
+
+private:
+	void _write(const char* data, size_t n)
+	{
+		while(n > 0 && !_failed)
+		{
+			ssize_t res = ::write(_fd, data, n);
+			if(res < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				cerr << "warning: writing to " << _name << " failed, dropping the rest of the output: " << strerror(errno) << "\n";
+				_failed = true;
+				break;
+			}
+			data += res;
+			n -= res;
+			_written += res;
+		}
+	}
+
+private:
+	string				_name;
+	int					_fd{-1};
+	bool				_owned{false};
+	bool				_failed{false};
+	unique_ptr<char[]>	_buffer;
+	size_t				_capacity;
+	size_t				_size{0};
+	size_t				_written{0};
+};
+
+/*
+ * The composite top of book stream as time,symbol,bid,bid_size,ask,ask_size lines, laid out like
+ * CompositeTopLevel::toString but with prices exact to the tick.
+ * */
+class TopOfBookSink
+{
+public:
+	TopOfBookSink(const string& file, size_t bufferSize = BufferedOutput::DefaultBufferSize) : _out(file, bufferSize) {}
+
+	template<class TopLevel>
+	void write(const TopLevel& top)
+	{
+		const string& symbol = SymbolTable::instance().name(top.Symbolid());
+		char* out = _out.reserve(MaxFixed + symbol.size());
+		out = TextFormat::appendTime(out, top.LastUpdate());
+		*out++ = ',';
+		memcpy(out, symbol.data(), symbol.size());
+		out += symbol.size();
+		*out++ = ',';
+		out = TextFormat::appendPrice(out, top.Bid().price());
+		*out++ = ',';
+		out = TextFormat::appendUnsigned(out, top.Bid().qty());
+		*out++ = ',';
+		out = TextFormat::appendPrice(out, top.Ask().price());
+		*out++ = ',';
+		out = TextFormat::appendUnsigned(out, top.Ask().qty());
+		*out++ = '\n';
+		_out.commit(out);
+	}
+
+	void flush() {_out.flush();}
+	size_t bytesWritten() const {return _out.bytesWritten();}
+
+private:
+	static constexpr size_t MaxFixed = TextFormat::MaxTime + 2 * (TextFormat::MaxPrice + TextFormat::MaxUnsigned) + 6;
+
+	BufferedOutput _out;
+};
+
+#endif
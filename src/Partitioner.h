@@ -0,0 +1,175 @@
+#ifndef _PARTITIONER_H
+#define _PARTITIONER_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <algorithm>
+#include <unordered_map>
+#include <queue>
+#include <functional>
+#include <stdexcept>
+#include "SymbolTable.h"
+
+using namespace std;
+
+// messages per symbol over any period, only the proportions matter
+typedef unordered_map<SymbolID, double> SymbolRates;
+
+/*
+ * Which book processor owns a symbol. Symbols assigned explicitly are looked up in a flat table,
+ * any other symbol is spread by id over the fallback processors.
+ * */
+class SymbolPartition
+{
+public:
+	SymbolPartition(int processors) : _processors(processors), _load(processors, 0.0)
+	{
+		for(int i=0;i<processors;i++)
+			_fallback.push_back(i);
+	}
+
+	inline int processorOf(SymbolID symbol) const
+	{
+		if(symbol < _table.size() && _table[symbol] >= 0)
+			return _table[symbol];
+		return _fallback[symbol % _fallback.size()];
+	}
+
+	void assign(SymbolID symbol, int processor, double rate = 0.0)
+	{
+		if(symbol >= _table.size())
+			_table.resize(symbol+1, -1);
+		_table[symbol] = processor;
+		_load[processor] += rate;
+	}
+
+	// processors which take the symbols without a rate, not empty
+	void setFallback(const vector<int>& processors) {_fallback = processors;}
+
+	int processors() const {return _processors;}
+	// the load the assignment was built for, from the rates of the assigned symbols
+	const vector<double>& plannedLoad() const {return _load;}
+
+private:
+	int			   _processors;
+	vector<int>	   _table;		// by SymbolID, -1 if not assigned
+	vector<int>	   _fallback;
+	vector<double> _load;
+};
+
+class Partitioner
+{
+public:
+	virtual ~Partitioner() {}
+	virtual SymbolPartition partition(const SymbolRates& rates, int processors) const = 0;
+};
+
+typedef shared_ptr<Partitioner> PartitionerPtr;
+
+// symbol id modulo processor count, ignores the rates
+class HashPartitioner : public Partitioner
+{
+public:
+	SymbolPartition partition(const SymbolRates& rates, int processors) const
+	{
+		SymbolPartition result(processors);
+		for(const auto& p : rates)
+			result.assign(p.first, p.first % processors, p.second);
+		return result;
+	}
+};
+
+/*
+ * Gives each symbol heavier than an even share of what is left its own processor - heaviest
+ * first, always keeping one processor for the rest - then packs the remaining symbols heaviest
+ * first onto the least loaded of the shared processors. Symbols without a rate go to the
+ * shared processors too.
+ * */
+class LoadAwarePartitioner : public Partitioner
+{
+public:
+	SymbolPartition partition(const SymbolRates& rates, int processors) const
+	{
+		vector<pair<double, SymbolID>> byRate;
+		double remaining = 0.0;
+		for(const auto& p : rates)
+		{
+			byRate.emplace_back(p.second, p.first);
+			remaining += p.second;
+		}
+		// ties by id, so the same rates always give the same assignment
+		sort(byRate.begin(), byRate.end(), [](const pair<double, SymbolID>& a, const pair<double, SymbolID>& b){
+			return a.first > b.first || (a.first == b.first && a.second < b.second);
+		});
+
+		SymbolPartition result(processors);
+		int dedicated = 0;
+		size_t next = 0;
+		for(;next < byRate.size() && dedicated < processors-1;next++)
+		{
+			double rate = byRate[next].first;
+			if(rate <= 0.0 || rate < remaining / (processors - dedicated))
+				break;
+			result.assign(byRate[next].second, dedicated++, rate);
+			remaining -= rate;
+		}
+
+		vector<int> shared;
+		typedef pair<double, int> Bin;	// load, processor
+		priority_queue<Bin, vector<Bin>, greater<Bin>> leastLoaded;
+		for(int i=dedicated;i<processors;i++)
+		{
+			shared.push_back(i);
+			leastLoaded.push(Bin(0.0, i));
+		}
+		for(;next < byRate.size();next++)
+		{
+			Bin bin = leastLoaded.top();
+			leastLoaded.pop();
+			result.assign(byRate[next].second, bin.second, byRate[next].first);
+			bin.first += byRate[next].first;
+			leastLoaded.push(bin);
+		}
+		result.setFallback(shared);
+		return result;
+	}
+};
+
+// one symbol,rate per line
+inline SymbolRates readSymbolRates(const string& file)
+{
+	ifstream in(file);
+	if(!in)
+		throw invalid_argument("cannot read symbol rates from " + file);
+	SymbolRates rates;
+	string line;
+	while(getline(in, line))
+	{
+		size_t comma = line.find(',');
+		if(line.empty() || comma == string::npos)
+			continue;
+		double rate;
+		try
+		{
+			rate = stod(line.substr(comma+1));
+		}
+		catch(const logic_error&)
+		{
+			// stod's invalid_argument and out_of_range only name the function
+			throw invalid_argument("invalid rate in " + file + ": " + line);
+		}
+		rates[SymbolTable::instance().intern(string_view(line).substr(0, comma))] += rate;
+	}
+	return rates;
+}
+
+inline void writeSymbolRates(const string& file, const SymbolRates& rates)
+{
+	ofstream out(file);
+	for(const auto& p : rates)
+		out << SymbolTable::instance().name(p.first) << "," << p.second << "\n";
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef _PRICE_H
+#define _PRICE_H
+
+#include <cstdint>
+#include <cmath>
+
+/*
+ * Prices are integer ticks of 10^-MDM_PRICE_DECIMALS, compared and summed exactly.
+ * Doubles are only produced when printing.
+ * */
+#ifndef MDM_PRICE_DECIMALS
+#define MDM_PRICE_DECIMALS 4
+#endif
+
+typedef int64_t Price;
+
+constexpr int PriceDecimals = MDM_PRICE_DECIMALS;
+
+constexpr Price pow10Price(int exp) {return exp == 0 ? 1 : 10 * pow10Price(exp - 1);}
+
+constexpr Price PriceScale = pow10Price(PriceDecimals);
+
+static_assert(PriceDecimals >= 0 && PriceDecimals <= 9, "MDM_PRICE_DECIMALS must be between 0 and 9");
+
+inline double priceToDouble(Price p) {return static_cast<double>(p) / PriceScale;}
+inline Price  priceFromDouble(double p) {return std::llround(p * PriceScale);}
+
+#endif
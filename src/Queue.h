@@ -54,6 +54,45 @@ public:
 		return true;
 	}
 
+	// one lock and one notification for the whole batch
+	template<class It>
+	void pushBatch(It first, It last)
+	{
+		if(first == last)
+			return;
+		std::unique_lock<std::mutex> lock(_m);
+		if(!_stopRequested.load())
+		{
+			for(;first != last;++first)
+				Queue<T>::_q.push(*first);
+			_cv.notify_all();
+		}
+	}
+
+	// waits like pop for the first element, then moves out whatever else is queued up to max
+	// returns the number appended to out, 0 only once stopped and empty
+	template<class Container>
+	size_t drainTo(Container& out, size_t max)
+	{
+		std::unique_lock<std::mutex> lock(_m);
+		while(Queue<T>::_q.size()==0)
+		{
+			if(_cv.wait_for(lock, _timeoutDuration) == std::cv_status::timeout)
+			{
+				if(_stopRequested.load() == true && Queue<T>::_q.size()==0)
+					return 0;
+			}
+		}
+
+		size_t count = 0;
+		for(;count < max && Queue<T>::_q.size() > 0;++count)
+		{
+			out.push_back(std::move(Queue<T>::_q.front()));
+			Queue<T>::_q.pop();
+		}
+		return count;
+	}
+
 	void requestStop() {_stopRequested.store(true);}
 
 
@@ -0,0 +1,123 @@
+#ifndef _REBALANCER_H
+#define _REBALANCER_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+using namespace std;
+
+/*
+ * Watches the book processors and asks for load to be moved off one whose queue depth or busy
+ * time stays well above the least loaded processor's for several periods in a row.
+ * A processor's load is the share of the period it was busy plus its queue fill, so a processor
+ * which falls behind counts as overloaded even before it is busy all the time.
+ * */
+class Rebalancer
+{
+public:
+	struct Sample
+	{
+		size_t	 queueDepth;
+		uint64_t busyNanos;		// running total
+	};
+	using Probe = function<Sample(int processor)>;
+	using Trigger = function<void(int from, int to)>;
+
+	static constexpr double LoadRatio = 2.0;		// overloaded: this many times the least loaded
+	static constexpr double MinLoad = 0.5;			// and at least half busy or half queued
+	static constexpr int	Persistence = 3;		// periods in a row before moving anything
+
+	Rebalancer(int processors, size_t queueCapacity, const Probe& probe, const Trigger& trigger) : _processors(processors),
+																								  _queueCapacity(queueCapacity),
+																								  _probe(probe),
+																								  _trigger(trigger),
+																								  _lastBusy(processors, 0) {}
+	~Rebalancer()
+	{
+		stop();
+	}
+
+	void start(chrono::milliseconds period)
+	{
+		_thread = std::thread(&Rebalancer::_watching, this, period);
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopRequested = true;
+		}
+		_stopCV.notify_all();
+		if(_thread.joinable())
+			_thread.join();
+	}
+
+	// one period's load per processor, true with the processors to move load between once the
+	// same processor was overloaded for Persistence periods
+	bool observe(const vector<double>& load, int& from, int& to)
+	{
+		size_t busiest = 0, idlest = 0;
+		for(size_t i=1;i<load.size();i++)
+		{
+			if(load[i] > load[busiest])
+				busiest = i;
+			if(load[i] < load[idlest])
+				idlest = i;
+		}
+		bool overloaded = load.size() > 1 && load[busiest] >= MinLoad && load[busiest] >= LoadRatio * load[idlest];
+		if(!overloaded)
+		{
+			_streak = 0;
+			return false;
+		}
+		_streak = int(busiest) == _streakProcessor ? _streak+1 : 1;
+		_streakProcessor = busiest;
+		if(_streak < Persistence)
+			return false;
+		_streak = 0;
+		from = busiest;
+		to = idlest;
+		return true;
+	}
+
+private:
+	void _watching(chrono::milliseconds period)
+	{
+		vector<double> load(_processors);
+		std::unique_lock<std::mutex> lock(_mutex);
+		while(!_stopCV.wait_for(lock, period, [this]{return _stopRequested;}))
+		{
+			for(int i=0;i<_processors;i++)
+			{
+				Sample sample = _probe(i);
+				double busy = double(sample.busyNanos - _lastBusy[i]) / chrono::nanoseconds(period).count();
+				_lastBusy[i] = sample.busyNanos;
+				load[i] = busy + double(sample.queueDepth) / _queueCapacity;
+			}
+			int from, to;
+			if(observe(load, from, to))
+				_trigger(from, to);
+		}
+	}
+
+private:
+	int				   _processors;
+	size_t			   _queueCapacity;
+	Probe			   _probe;
+	Trigger			   _trigger;
+	vector<uint64_t>   _lastBusy;
+	int				   _streak{0};
+	int				   _streakProcessor{-1};
+	std::thread		   _thread;
+	std::mutex		   _mutex;
+	condition_variable _stopCV;
+	bool			   _stopRequested{false};
+};
+
+#endif
@@ -3,7 +3,10 @@
 
 #include "TimePoint.h"
 #include "Tokenizer.h"
+#include "NumberParser.h"
+#include "SymbolTable.h"
 #include "CommonDefs.h"
+#include "StageTimes.h"
 #include <sstream>
 
 using namespace std;
@@ -13,37 +16,57 @@ using namespace std;
 class Record
 {
 public:
-	Record(const string& line, const Tokenizer tokenizer, FeedID feedID, const chrono::high_resolution_clock::time_point& timestamp) : _feedID(feedID), _receivedTime(timestamp)
+	// readTicks: when the line was read
+	Record(string_view line, const Tokenizer tokenizer, SymbolCache& symbols, FeedID feedID, TscClock::Ticks readTicks) : _feedID(feedID)
 	{
-		//LOG("parsing line: " + line);
-		_parseLine(line, tokenizer);
+		LOG_DEBUG("parsing line: {}", line);
+		_stamps.stamp(Stage::Read, readTicks);
+		_parseLine(line, tokenizer, &symbols);
+		_stamps.stamp(Stage::Parsed);
 	}
 
-	Record(const string& line, const Tokenizer tokenizer, FeedID feedID) : _feedID(feedID), _receivedTime(std::chrono::high_resolution_clock::now())
+	// interns through the shared symbol table
+	Record(string_view line, const Tokenizer tokenizer, FeedID feedID) : _feedID(feedID)
 	{
-		//LOG("parsing line: " + line);
-		_parseLine(line, tokenizer);
+		LOG_DEBUG("parsing line: {}", line);
+		_stamps.stamp(Stage::Read);
+		_parseLine(line, tokenizer, nullptr);
+		_stamps.stamp(Stage::Parsed);
 	}
 
-	Record(const TimePoint& tp, const string& symbol, double bidPrice, uint bidSize, double askPrice, uint askSize, const FeedID& feedid) :
-			_symbol(symbol), _bid(bidPrice), _bid_size(bidSize), _ask(askPrice), _ask_size(askSize), _feedID(feedid), _time(tp), _receivedTime(std::chrono::high_resolution_clock::now())
-	{}
+	// decoded from the binary format, nothing to parse
+	Record(const TimePoint& tp, SymbolID symbol, Price bidPrice, uint bidSize, Price askPrice, uint askSize, FeedID feedid, TscClock::Ticks readTicks) :
+			_symbol(symbol), _bid(bidPrice), _bid_size(bidSize), _ask(askPrice), _ask_size(askSize), _feedID(feedid), _time(tp)
+	{
+		_stamps.stamp(Stage::Read, readTicks);
+		_stamps.stamp(Stage::Parsed);
+	}
+
+	Record(const TimePoint& tp, const string& symbol, Price bidPrice, uint bidSize, Price askPrice, uint askSize, const FeedID& feedid) :
+			_symbol(SymbolTable::instance().intern(symbol)), _bid(bidPrice), _bid_size(bidSize), _ask(askPrice), _ask_size(askSize), _feedID(feedid), _time(tp)
+	{
+		_stamps.stamp(Stage::Read);
+		_stamps.stamp(Stage::Parsed, _stamps.at(Stage::Read));
+	}
 
 
 	const FeedID&    Feedid() const {return _feedID;}
 	const TimePoint& Time() const {return _time;}
-	const string&	 Symbol() const {return _symbol;}
-	double 			 Bid() const {return _bid;}
+	SymbolID		 Symbolid() const {return _symbol;}
+	const string&	 Symbol() const {return SymbolTable::instance().name(_symbol);}
+	Price 			 Bid() const {return _bid;}
 	unsigned int     BidSize() const {return _bid_size;}
-	double 			 Ask() const {return _ask;}
+	Price 			 Ask() const {return _ask;}
 	unsigned int     AskSize() const {return _ask_size;}
 
-	const chrono::high_resolution_clock::time_point& TimeStamp() const {return _receivedTime;}
+	const StageStamps& Stamps() const {return _stamps;}
+	inline void		   stamp(Stage stage) {_stamps.stamp(stage);}
+	inline void		   stamp(Stage stage, TscClock::Ticks ticks) {_stamps.stamp(stage, ticks);}
 
 	std::string toString() const
 	{
 		stringstream ss;
-		ss << Feedid() << "," << Time().toString() << "," << Symbol() << "," << Bid() << "," << BidSize() << "," << Ask() << "," << AskSize();
+		ss << Feedid() << "," << Time().toString() << "," << Symbol() << "," << priceToDouble(Bid()) << "," << BidSize() << "," << priceToDouble(Ask()) << "," << AskSize();
 		return ss.str();
 	}
 
@@ -63,7 +86,7 @@ public:
 	class RecordInvalid : public std::exception
 	{
 	public:
-		RecordInvalid(const std::string& line) : _line(line) {}
+		RecordInvalid(std::string_view line) : _line(line) {}
 		virtual const char* what() const noexcept
 		{
 			return _line.c_str();
@@ -74,20 +97,25 @@ public:
 
 private:
 	// might fail badly if the data structure is not correct
-	void _parseLine(const string& line, const Tokenizer& tokenizer)
+	void _parseLine(string_view line, const Tokenizer& tokenizer, SymbolCache* symbols)
 	{
-		bool result = true;
 		_sanityCheck(line);
-		vector<string> tokenz = tokenizer.tokenize(line);
+		// captures may come with windows line endings
+		if(line.back() == '\r')
+			line.remove_suffix(1);
+		array<string_view, FieldCount> tokenz;
+		if(tokenizer.tokenize(line, tokenz) != FieldCount)
+			throw RecordInvalid(line);
 		_time = TimePoint(tokenz[0]);
-		_symbol = tokenz[1];
-		_bid = stod(tokenz[2]);
-		_bid_size = stoi(tokenz[3]);
-		_ask = stod(tokenz[4]);
-		_ask_size = stoi(tokenz[5]);
+		if(!_time.isValid())
+			throw RecordInvalid(line);
+		_symbol = symbols ? symbols->lookup(tokenz[1]) : SymbolTable::instance().intern(tokenz[1]);
+		if(!NumberParser::parsePrice(tokenz[2], _bid) || !NumberParser::parseUnsigned(tokenz[3], _bid_size) ||
+		   !NumberParser::parsePrice(tokenz[4], _ask) || !NumberParser::parseUnsigned(tokenz[5], _ask_size))
+			throw RecordInvalid(line);
 	}
 
-	void _sanityCheck(const string& line)
+	void _sanityCheck(string_view line)
 	{
 		if(line.size() == 0 || isspace(line[0]))
 			throw RecordInvalid(line);
@@ -95,14 +123,16 @@ private:
 
 
 private:
+	static constexpr size_t FieldCount = 6;
+
 	FeedID		_feedID;
 	TimePoint 	_time;
-	string 		_symbol;
-	double 		_bid;
+	SymbolID 	_symbol;
+	Price 		_bid;
 	unsigned int 		_bid_size;
-	double  	_ask;
+	Price  		_ask;
 	unsigned int		  	_ask_size;
-	chrono::high_resolution_clock::time_point _receivedTime;
+	StageStamps	_stamps;
 };
 
 ostream& operator<<(ostream& os, const Record& record)
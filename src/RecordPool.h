@@ -0,0 +1,182 @@
+#ifndef _RECORDPOOL_H
+#define _RECORDPOOL_H
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <utility>
+#include "Record.h"
+
+/*
+ * Slab backed allocator for Records. Records are created on the feed thread and released
+ * on the processor threads, so each thread keeps its own free list: a releasing thread
+ * collects freed slots and hands them back to the shared pool in batches, where the
+ * creating thread picks them up a batch at a time. Once warmed up no heap allocation happens
+ * and the shared pool is only locked once per batch.
+ * */
+class RecordPool
+{
+public:
+	static constexpr size_t BatchSize = 64;
+	static constexpr size_t SlabSize = 4096;
+
+	RecordPool() {}
+	RecordPool(const RecordPool&) = delete;
+	RecordPool& operator=(const RecordPool&) = delete;
+
+	static RecordPool& instance()
+	{
+		static RecordPool pool;
+		return pool;
+	}
+
+	template<class... Args>
+	static RecordPtr create(Args&&... args)
+	{
+		void* slot = instance()._allocate();
+		try
+		{
+			return new (slot) Record(std::forward<Args>(args)...);
+		}
+		catch(...)
+		{
+			instance()._free(slot);
+			throw;
+		}
+	}
+
+	static void release(RecordPtr rec)
+	{
+		if(rec)
+		{
+			rec->~Record();
+			instance()._free(rec);
+		}
+	}
+
+	// number of records the slabs can hold, grows only while warming up
+	size_t capacity() const {return _capacity.load(std::memory_order_relaxed);}
+
+private:
+	// a free slot reuses the record's storage
+	struct FreeNode
+	{
+		FreeNode* next;
+		FreeNode* nextBatch;
+		size_t	  batchCount;	// set on the head of a batch
+	};
+
+	struct alignas(Record) Slot
+	{
+		unsigned char bytes[sizeof(Record) > sizeof(FreeNode) ? sizeof(Record) : sizeof(FreeNode)];
+	};
+
+	struct FreeList
+	{
+		FreeNode* head{nullptr};
+		size_t	  count{0};
+
+		void push(FreeNode* node)
+		{
+			node->next = head;
+			head = node;
+			++count;
+		}
+		FreeNode* pop()
+		{
+			FreeNode* node = head;
+			head = node->next;
+			--count;
+			return node;
+		}
+	};
+
+	struct ThreadCache
+	{
+		FreeList local;		// slots this thread allocates from
+		FreeList outgoing;	// slots freed here, handed back once a batch is full
+
+		~ThreadCache()
+		{
+			RecordPool& pool = instance();
+			pool._pushBatch(outgoing);
+			pool._pushBatch(local);
+		}
+	};
+
+	static ThreadCache& _cache()
+	{
+		thread_local ThreadCache cache;
+		return cache;
+	}
+
+	void* _allocate()
+	{
+		ThreadCache& cache = _cache();
+		if(cache.local.count == 0)
+		{
+			if(cache.outgoing.count > 0)
+				std::swap(cache.local, cache.outgoing);
+			else if(!_popBatch(cache.local))
+				_allocateSlab(cache.local);
+		}
+		return cache.local.pop();
+	}
+
+	void _free(void* slot)
+	{
+		ThreadCache& cache = _cache();
+		cache.outgoing.push(static_cast<FreeNode*>(slot));
+		if(cache.outgoing.count >= BatchSize)
+		{
+			_pushBatch(cache.outgoing);
+		}
+	}
+
+	void _pushBatch(FreeList& list)
+	{
+		if(list.count == 0)
+			return;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			list.head->nextBatch = _batches.head;
+			list.head->batchCount = list.count;
+			_batches.head = list.head;
+			_batches.count += list.count;
+		}
+		list = FreeList();
+	}
+
+	bool _popBatch(FreeList& list)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		FreeNode* batch = _batches.head;
+		if(!batch)
+			return false;
+		_batches.head = batch->nextBatch;
+		// a thread going away hands back its whole local list, so the length travels with the batch
+		list.head = batch;
+		list.count = batch->batchCount;
+		_batches.count -= list.count;
+		return true;
+	}
+
+	void _allocateSlab(FreeList& list)
+	{
+		Slot* slab = new Slot[SlabSize];
+		for(size_t i=0;i<SlabSize;i++)
+			list.push(reinterpret_cast<FreeNode*>(&slab[i]));
+		std::lock_guard<std::mutex> lock(_mutex);
+		_slabs.emplace_back(slab);
+		_capacity.fetch_add(SlabSize, std::memory_order_relaxed);
+	}
+
+private:
+	std::mutex						_mutex;
+	FreeList						_batches;	// heads chained through nextBatch
+	std::vector<std::unique_ptr<Slot[]>> _slabs;
+	std::atomic<size_t>				_capacity{0};
+};
+
+#endif
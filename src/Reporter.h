@@ -3,15 +3,35 @@
 
 #include <thread>
 #include <mutex>
-#include "Queue.h"
+#include "MPSCRingBuffer.h"
+#include "ConflatingQueue.h"
 #include "Book.h"
+#include "ThreadPlacement.h"
+#include "OutputSink.h"
 
 using namespace std;
 
+/*
+ * Every book processor publishes its top of book changes into one ring, written in place
+ * without a lock, the reporter thread reports them in the order they were claimed.
+ * Queued: every change is reported, the processors wait while the ring is full.
+ * Conflated: a symbol's changes the reporter did not get to yet collapse into the newest one,
+ * so a slow reporter never holds the processors up.
+ * */
 class Reporter
 {
 public:
-	Reporter() : _topOfBookChangedQueue(std::chrono::milliseconds(1000))
+	enum class Publication
+	{
+		Queued,
+		Conflated
+	};
+
+	static constexpr size_t QueueCapacity = 1 << 16;
+	static constexpr size_t BatchSize = 256;
+
+	Reporter(Publication publication = Publication::Queued) : _topOfBookChangedQueue(QueueCapacity),
+															  _conflatingQueue(publication == Publication::Conflated ? new ConflatingQueue<CompositeBook::CompositeTopLevel>(QueueCapacity) : nullptr)
 	{
 		_consumerThread = std::thread(&Reporter::_processing, this);
 	}
@@ -21,42 +41,70 @@ public:
 		join();
 	}
 
+	// any thread, never allocates or locks - waits only while the ring is full
 	void	publish(const CompositeBook::CompositeTopLevel& topOfBook)
 	{
-		_topOfBookChangedQueue.push(topOfBook);
+		if(_conflatingQueue)
+			_conflatingQueue->push(topOfBook.Symbolid(), topOfBook);
+		else
+			_topOfBookChangedQueue.push(topOfBook);
 	}
 
 	void requestStop()
 	{
 		_topOfBookChangedQueue.requestStop();
+		if(_conflatingQueue)
+			_conflatingQueue->requestStop();
 	}
 
+	bool isConflating() const {return _conflatingQueue != nullptr;}
+	// changes never reported because a newer one of the symbol replaced them
+	size_t conflatedCount() const {return _conflatingQueue ? _conflatingQueue->conflatedCount() : 0;}
+
 	void join()
 	{
 		if(_consumerThread.joinable())
 			_consumerThread.join();
 	}
 
+	bool place(const ThreadPlacement& placement)
+	{
+		return placement.apply(_consumerThread.native_handle(), "reporter");
+	}
+
 
 protected:
 	virtual void _report(const CompositeBook::CompositeTopLevel& book) = 0;
+	// on the reporter thread once everything was reported
+	virtual void _finished() {}
 
 private:
 	void _processing()
 	{
+		Backoff backoff;
+		auto report = [this](const CompositeBook::CompositeTopLevel& top) {_report(top);};
 		while(true)
 		{
-			CompositeBook::CompositeTopLevel top;
-			if(_topOfBookChangedQueue.pop(top))
-			{
-				_report(top);
-			}
-			else
+			if(_consume(report) > 0)
+				backoff.reset();
+			else if(_topOfBookChangedQueue.stopRequested() && (_conflatingQueue ? _conflatingQueue->isEmpty() : _topOfBookChangedQueue.isEmpty()))
 				break;
+			else
+				backoff.pause();
 		}
+		_finished();
 	}
+	template<class F>
+	size_t _consume(F& report)
+	{
+		if(_conflatingQueue)
+			return _conflatingQueue->consume(report, BatchSize);
+		return _topOfBookChangedQueue.consume(report, BatchSize);
+	}
+
 private:
-	BlockingQueue<CompositeBook::CompositeTopLevel> _topOfBookChangedQueue;
+	MPSCRingBuffer<CompositeBook::CompositeTopLevel> _topOfBookChangedQueue;
+	unique_ptr<ConflatingQueue<CompositeBook::CompositeTopLevel>> _conflatingQueue;
 	std::thread			  _consumerThread;
 	std::mutex			  _mutex;
 
@@ -65,10 +113,11 @@ private:
 typedef shared_ptr<Reporter> ReporterPtr;
 
 
+// writes the top of book stream to the sink if there is one
 class StandardOutputReporter : public Reporter
 {
 public:
-	StandardOutputReporter() {}
+	StandardOutputReporter(unique_ptr<TopOfBookSink> sink = nullptr, Publication publication = Publication::Queued) : Reporter(publication), _sink(std::move(sink)) {}
 	virtual ~StandardOutputReporter()
 	{
 		requestStop();
@@ -77,15 +126,29 @@ public:
 protected:
 	virtual void _report(const CompositeBook::CompositeTopLevel& top)
 	{
-		//cout << top.toString() << endl;
+		if(_sink && top.isValid())
+			_sink->write(top);
 	}
+
+	virtual void _finished() {_flush();}
+
+	void _flush()
+	{
+		if(_sink)
+			_sink->flush();
+	}
+
+private:
+	unique_ptr<TopOfBookSink> _sink;
 };
 
 
 class KnowsAboutFeedsStandardOutputReporter : public StandardOutputReporter
 {
 public:
-	KnowsAboutFeedsStandardOutputReporter(int numOfFeeds) : StandardOutputReporter(), _numOfFeeds(numOfFeeds) {}
+	// every book processor publishes an invalid top of book once it is done
+	KnowsAboutFeedsStandardOutputReporter(int numOfProcessors, unique_ptr<TopOfBookSink> sink = nullptr, Publication publication = Publication::Queued) :
+		StandardOutputReporter(std::move(sink), publication), _numOfProcessors(numOfProcessors) {}
 	virtual ~KnowsAboutFeedsStandardOutputReporter()
 	{
 		requestStop();
@@ -94,17 +157,21 @@ public:
 protected:
 	virtual void _report(const CompositeBook::CompositeTopLevel& top)
 	{
-		if(top.Symbol() == "")
+		if(!top.isValid())
 		{
-			++_numOfFeedEnded;
-			if(_numOfFeedEnded == _numOfFeeds)
+			++_numOfProcessorsEnded;
+			if(_numOfProcessorsEnded == _numOfProcessors)
+			{
+				// behind the stream if it goes to stdout too
+				_flush();
 				cout << "Done\n";
+			}
 		}
 		StandardOutputReporter::_report(top);
 	}
 private:
-	int _numOfFeeds;
-	int _numOfFeedEnded{0};
+	int _numOfProcessors;
+	int _numOfProcessorsEnded{0};
 };
 
 #endif
@@ -0,0 +1,189 @@
+#ifndef _SPSCRINGBUFFER_H
+#define _SPSCRINGBUFFER_H
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <cstddef>
+#include <algorithm>
+#include "Backoff.h"
+
+/*
+ * Bounded single producer single consumer ring, capacity rounded up to a power of two.
+ * Elements are constructed in place in the preallocated slots. The head and the tail live on
+ * their own cache lines next to a cached copy of the other side's index, so a side only
+ * touches the other's line when its cached view says the ring is full (or empty).
+ * try* never block, push/pop wait with a backoff and follow the BlockingQueue protocol:
+ * pop fails once a stop was requested and nothing is left.
+ * */
+template<class T>
+class SPSCRingBuffer
+{
+public:
+	static constexpr size_t CacheLine = 64;
+
+	// the slots are zeroed, so their pages are placed by the constructing thread and not by the first push
+	SPSCRingBuffer(size_t capacity) : _capacity(_roundUp(capacity)), _mask(_capacity-1), _slots(new Slot[_capacity]()) {}
+	SPSCRingBuffer(const SPSCRingBuffer&) = delete;
+	SPSCRingBuffer& operator=(const SPSCRingBuffer&) = delete;
+	~SPSCRingBuffer()
+	{
+		size_t tail = _producer.index.load(std::memory_order_acquire);
+		for(size_t head = _consumer.index.load(std::memory_order_acquire);head != tail;head++)
+			reinterpret_cast<T*>(_slots[head & _mask].bytes)->~T();
+	}
+
+	template<class... Args>
+	bool tryEmplace(Args&&... args)
+	{
+		size_t tail = _producer.index.load(std::memory_order_relaxed);
+		if(tail - _producer.cachedOther == _capacity)
+		{
+			_producer.cachedOther = _consumer.index.load(std::memory_order_acquire);
+			if(tail - _producer.cachedOther == _capacity)
+				return false;
+		}
+		new (_slots[tail & _mask].bytes) T(std::forward<Args>(args)...);
+		_producer.index.store(tail+1, std::memory_order_release);
+		return true;
+	}
+
+	bool tryPush(const T& val) {return tryEmplace(val);}
+
+	bool tryPop(T& val)
+	{
+		size_t head = _consumer.index.load(std::memory_order_relaxed);
+		if(head == _consumer.cachedOther)
+		{
+			_consumer.cachedOther = _producer.index.load(std::memory_order_acquire);
+			if(head == _consumer.cachedOther)
+				return false;
+		}
+		T* elem = reinterpret_cast<T*>(_slots[head & _mask].bytes);
+		val = std::move(*elem);
+		elem->~T();
+		_consumer.index.store(head+1, std::memory_order_release);
+		return true;
+	}
+
+	// waits while full
+	template<class... Args>
+	void emplace(Args&&... args)
+	{
+		Backoff backoff;
+		while(!tryEmplace(std::forward<Args>(args)...))
+			backoff.pause();
+	}
+
+	void push(const T& val) {emplace(val);}
+
+	// waits while empty, false once stopped and drained
+	bool pop(T& val)
+	{
+		Backoff backoff;
+		while(!tryPop(val))
+		{
+			if(_stopRequested.load(std::memory_order_acquire))
+				return tryPop(val);
+			backoff.pause();
+		}
+		return true;
+	}
+
+	// publishes as many as fit with a single index update, waits while full for the rest
+	template<class It>
+	void pushBatch(It first, It last)
+	{
+		Backoff backoff;
+		while(first != last)
+		{
+			size_t tail = _producer.index.load(std::memory_order_relaxed);
+			size_t room = _capacity - (tail - _producer.cachedOther);
+			if(room == 0)
+			{
+				_producer.cachedOther = _consumer.index.load(std::memory_order_acquire);
+				room = _capacity - (tail - _producer.cachedOther);
+				if(room == 0)
+				{
+					backoff.pause();
+					continue;
+				}
+			}
+			size_t end = tail;
+			for(;first != last && end - tail < room;++first, ++end)
+				new (_slots[end & _mask].bytes) T(*first);
+			_producer.index.store(end, std::memory_order_release);
+			backoff.reset();
+		}
+	}
+
+	// waits like pop for the first element, then takes whatever else is there up to max
+	// with a single index update - returns the number appended to out, 0 once stopped and drained
+	template<class Container>
+	size_t drainTo(Container& out, size_t max)
+	{
+		Backoff backoff;
+		size_t head = _consumer.index.load(std::memory_order_relaxed);
+		while(head == _consumer.cachedOther)
+		{
+			bool stopped = _stopRequested.load(std::memory_order_acquire);
+			_consumer.cachedOther = _producer.index.load(std::memory_order_acquire);
+			if(head != _consumer.cachedOther)
+				break;
+			if(stopped)
+				return 0;
+			backoff.pause();
+		}
+
+		size_t count = std::min(max, _consumer.cachedOther - head);
+		for(size_t i=0;i<count;i++)
+		{
+			T* elem = reinterpret_cast<T*>(_slots[(head+i) & _mask].bytes);
+			out.push_back(std::move(*elem));
+			elem->~T();
+		}
+		_consumer.index.store(head+count, std::memory_order_release);
+		return count;
+	}
+
+	void requestStop() {_stopRequested.store(true, std::memory_order_release);}
+
+	// approximate when called concurrently
+	size_t size() const
+	{
+		size_t head = _consumer.index.load(std::memory_order_acquire);
+		return _producer.index.load(std::memory_order_acquire) - head;
+	}
+	size_t capacity() const {return _capacity;}
+
+private:
+	static size_t _roundUp(size_t n)
+	{
+		size_t cap = 1;
+		while(cap < n)
+			cap <<= 1;
+		return cap;
+	}
+
+	struct Slot
+	{
+		alignas(T) unsigned char bytes[sizeof(T)];
+	};
+
+	// one side's index with its cached view of the other side's
+	struct alignas(CacheLine) Side
+	{
+		std::atomic<size_t> index{0};
+		size_t				cachedOther{0};
+	};
+
+private:
+	const size_t			 _capacity;
+	const size_t			 _mask;
+	std::unique_ptr<Slot[]>	 _slots;
+	Side					 _producer;	// index is the tail, the next slot to write
+	Side					 _consumer;	// index is the head, the next slot to read
+	alignas(CacheLine) std::atomic<bool> _stopRequested{false};
+};
+
+#endif
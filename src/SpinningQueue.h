@@ -81,6 +81,41 @@ public:
 		return true;
 	}
 
+	template<class It>
+	void pushBatch(It first, It last)
+	{
+		_lock.lock();
+		for(;first != last;++first)
+			_q.push(*first);
+		_lock.unlock();
+	}
+
+	// spins like pop for the first element, then moves out whatever else is queued up to max
+	// returns the number appended to out, 0 only once stopped and empty
+	template<class Container>
+	size_t drainTo(Container& out, size_t max)
+	{
+		size_t count = 0;
+		while(true)
+		{
+			// read before looking at the queue so a push right before the stop is not missed
+			bool stopped = _stopRequested.load();
+			_lock.lock();
+			for(;count < max && !_q.empty();++count)
+			{
+				out.push_back(std::move(_q.front()));
+				_q.pop();
+			}
+			_lock.unlock();
+			if(count > 0)
+				break;
+			else if(stopped)
+				return 0;
+		}
+
+		return count;
+	}
+
 	void requestStop() {_stopRequested.store(true);}
 private:
 	spinlock _lock;
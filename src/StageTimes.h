@@ -0,0 +1,90 @@
+#ifndef _STAGETIMES_H
+#define _STAGETIMES_H
+
+#include <array>
+#include <string>
+#include "TscClock.h"
+#include "Histogram.h"
+
+using namespace std;
+
+/*
+ * The points a record passes on its way from the input to its book, in order:
+ * Read			the line was read, before parsing
+ * Parsed		the record was built
+ * Merged		the consolidated feed handed it to the consumer
+ * Routed		the multiplexer took the batch it is in off its queue - not stamped with direct routing
+ * Dequeued		the processor took the batch it is in off the queue
+ * Applied		its book was updated
+ * */
+enum class Stage
+{
+	Read,
+	Parsed,
+	Merged,
+	Routed,
+	Dequeued,
+	Applied,
+	Count
+};
+
+constexpr size_t StageCount = size_t(Stage::Count);
+
+// TSC ticks of each stage a record passed, 0 for the ones it did not
+class StageStamps
+{
+public:
+	inline void stamp(Stage stage) {_ticks[size_t(stage)] = TscClock::now();}
+	inline void stamp(Stage stage, TscClock::Ticks ticks) {_ticks[size_t(stage)] = ticks;}
+	inline TscClock::Ticks at(Stage stage) const {return _ticks[size_t(stage)];}
+
+private:
+	array<TscClock::Ticks, StageCount> _ticks{};
+};
+
+/*
+ * Nanosecond histograms of the time spent between consecutive stages, one per interval and
+ * named after the stage it ends with, plus the whole way from Read to Applied.
+ * A stage a record skipped counts into the next interval.
+ * */
+class StageLatencies
+{
+public:
+	static constexpr size_t Intervals = StageCount - 1;
+
+	static const char* intervalName(size_t i)
+	{
+		static const char* names[Intervals] = {"parse", "merge", "multiplexer", "processorQueue", "bookUpdate"};
+		return names[i];
+	}
+
+	void record(const StageStamps& stamps)
+	{
+		TscClock::Ticks previous = stamps.at(Stage::Read);
+		for(size_t i=0;i<Intervals;i++)
+		{
+			TscClock::Ticks ticks = stamps.at(Stage(i+1));
+			if(ticks == 0)
+				continue;
+			_intervals[i].record(TscClock::nanosBetween(previous, ticks));
+			previous = ticks;
+		}
+		_total.record(TscClock::nanosBetween(stamps.at(Stage::Read), previous));
+	}
+
+	void merge(const StageLatencies& other)
+	{
+		for(size_t i=0;i<Intervals;i++)
+			_intervals[i].merge(other._intervals[i]);
+		_total.merge(other._total);
+	}
+
+	const LatencyHistogram& interval(size_t i) const {return _intervals[i];}
+	const LatencyHistogram& total() const {return _total;}
+
+private:
+	array<LatencyHistogram, Intervals> _intervals;
+	LatencyHistogram				   _total;
+};
+
+#endif
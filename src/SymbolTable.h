@@ -0,0 +1,105 @@
+#ifndef _SYMBOLTABLE_H
+#define _SYMBOLTABLE_H
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <cstdint>
+#include <stdexcept>
+
+typedef uint32_t SymbolID;
+
+constexpr SymbolID InvalidSymbolID = std::numeric_limits<SymbolID>::max();
+
+/*
+ * Interns symbol names into dense ids handed out from 0, so the pipeline can key on
+ * small integers and index flat vectors instead of hashing strings.
+ * Names are kept in fixed chunks which never move - a name reference and the ids
+ * stay valid for the lifetime of the table.
+ * */
+class SymbolTable
+{
+public:
+	SymbolTable() {}
+	SymbolTable(const SymbolTable&) = delete;
+	SymbolTable& operator=(const SymbolTable&) = delete;
+
+	// the process wide table used by the feeds
+	static SymbolTable& instance()
+	{
+		static SymbolTable table;
+		return table;
+	}
+
+	// thread safe
+	SymbolID intern(std::string_view symbol)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _ids.find(symbol);
+		if(it != _ids.end())
+			return it->second;
+
+		SymbolID id = _size.load(std::memory_order_relaxed);
+		size_t chunk = id >> ChunkBits;
+		if(chunk >= MaxChunks)
+			throw std::length_error("SymbolTable is full");
+		if(!_chunks[chunk])
+			_chunks[chunk].reset(new std::string[ChunkSize]);
+		std::string& name = _chunks[chunk][id & (ChunkSize-1)];
+		name.assign(symbol.data(), symbol.size());
+		_ids.emplace(std::string_view(name), id);
+		_size.store(id+1, std::memory_order_release);
+		return id;
+	}
+
+	// the id has to come from intern - passing it to another thread through any of
+	// the queues makes the name visible there
+	const std::string& name(SymbolID id) const
+	{
+		return _chunks[id >> ChunkBits][id & (ChunkSize-1)];
+	}
+
+	size_t size() const {return _size.load(std::memory_order_acquire);}
+
+private:
+	static constexpr size_t ChunkBits = 10;
+	static constexpr size_t ChunkSize = 1 << ChunkBits;
+	static constexpr size_t MaxChunks = 4096;
+
+	std::unique_ptr<std::string[]> 				  _chunks[MaxChunks];
+	std::unordered_map<std::string_view, SymbolID> _ids;
+	std::atomic<SymbolID>						  _size{0};
+	std::mutex									  _mutex;
+};
+
+
+/*
+ * Lock free front of the table for a single thread (one per feed), only going
+ * to the shared table the first time it sees a symbol.
+ * */
+class SymbolCache
+{
+public:
+	SymbolCache(SymbolTable& table = SymbolTable::instance()) : _table(table) {}
+
+	SymbolID lookup(std::string_view symbol)
+	{
+		auto it = _ids.find(symbol);
+		if(it != _ids.end())
+			return it->second;
+		SymbolID id = _table.intern(symbol);
+		// key on the table's copy of the name, the line the view came from goes away
+		_ids.emplace(std::string_view(_table.name(id)), id);
+		return id;
+	}
+
+private:
+	SymbolTable& 								  _table;
+	std::unordered_map<std::string_view, SymbolID> _ids;
+};
+
+#endif
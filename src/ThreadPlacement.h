@@ -0,0 +1,95 @@
+#ifndef _THREADPLACEMENT_H
+#define _THREADPLACEMENT_H
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+using namespace std;
+
+/*
+ * Where a pipeline thread runs: the cpu it is pinned to and its SCHED_FIFO priority.
+ * The defaults leave the thread to the OS scheduler. Applying is best effort - real time
+ * priorities usually need CAP_SYS_NICE - a failure is reported on cerr and the thread runs on
+ * unpinned or with the default policy.
+ * */
+struct ThreadPlacement
+{
+	int cpu{-1};		// -1: no affinity
+	int priority{0};	// 0: default policy
+
+	bool isDefault() const {return cpu < 0 && priority <= 0;}
+
+	bool apply(pthread_t thread, const char* name) const
+	{
+		bool ok = true;
+#ifdef __linux__
+		if(cpu >= 0)
+		{
+			int err = EINVAL;
+			if(cpu < CPU_SETSIZE)
+			{
+				cpu_set_t cpus;
+				CPU_ZERO(&cpus);
+				CPU_SET(cpu, &cpus);
+				err = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+			}
+			ok = _check(err, name, "pin to cpu " + to_string(cpu)) && ok;
+		}
+		if(priority > 0)
+		{
+			sched_param params;
+			params.sched_priority = priority;
+			ok = _check(pthread_setschedparam(thread, SCHED_FIFO, &params), name, "set SCHED_FIFO priority " + to_string(priority)) && ok;
+		}
+#else
+		if(!isDefault())
+			ok = _check(ENOTSUP, name, "place thread");
+#endif
+		return ok;
+	}
+
+	bool applyToCurrentThread(const char* name) const {return apply(pthread_self(), name);}
+
+private:
+	static bool _check(int err, const char* name, const string& what)
+	{
+		if(err != 0)
+			cerr << "warning: could not " << what << " for the " << name << " thread: " << strerror(err) << "\n";
+		return err == 0;
+	}
+};
+
+/*
+ * Placement of every thread of the pipeline. Readers and processors take their cpus round robin
+ * from their lists, an empty list leaves them unpinned. The real time priority goes to the
+ * threads on the path of a record - feed, readers, multiplexer and processors - the reporter
+ * and the logger keep the default policy.
+ * */
+struct ThreadLayout
+{
+	int			feedCpu{-1};
+	int			multiplexerCpu{-1};
+	int			reporterCpu{-1};
+	int			loggerCpu{-1};
+	vector<int>	readerCpus;
+	vector<int>	processorCpus;
+	int			realTimePriority{0};
+
+	ThreadPlacement feed() const {return {feedCpu, realTimePriority};}
+	ThreadPlacement multiplexer() const {return {multiplexerCpu, realTimePriority};}
+	ThreadPlacement reader(size_t i) const {return {_pick(readerCpus, i), realTimePriority};}
+	ThreadPlacement processor(size_t i) const {return {_pick(processorCpus, i), realTimePriority};}
+	ThreadPlacement reporter() const {return {reporterCpu, 0};}
+	ThreadPlacement logger() const {return {loggerCpu, 0};}
+
+private:
+	static int _pick(const vector<int>& cpus, size_t i) {return cpus.empty() ? -1 : cpus[i % cpus.size()];}
+};
+
+#endif
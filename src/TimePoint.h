@@ -2,87 +2,128 @@
 #define _TIMEPOINT_H
 
 #include <string>
+#include <string_view>
 #include <chrono>
+#include <cstdint>
+#include <cstdio>
 
 using namespace std;
 
+/*
+ * Time of day as nanoseconds since midnight, so comparing two of them is a single integer compare.
+ * Parsed from HH:MM:SS[.f{1,9}] by fixed position, the string form is only for output.
+ * */
 class TimePoint
 {
 public:
-	TimePoint() : _valid(false)
+	constexpr TimePoint() : _nanos(Invalid)
 	{
 	}
-	TimePoint(const string& time) : TimePoint(time.c_str())
+	TimePoint(const string& time) : TimePoint(string_view(time))
 	{
 
 	}
-	TimePoint(const char* time) : _valid(true)
+	constexpr TimePoint(const char* time) : TimePoint(string_view(time))
+	{
+	}
+	// the view does not have to be null terminated
+	constexpr TimePoint(string_view time) : _nanos(parse(time))
 	{
-		sscanf(time, formatString,
-			&vec[0],
-			&vec[1],
-			&vec[2],
-			&vec[3]);
 	}
 
-	inline int hr() const {return vec[0];}
-	inline int min() const {return vec[1];}
-	inline int sec() const {return vec[2];}
-	inline int millisec() const {return vec[3];}
+	static constexpr TimePoint fromNanos(int64_t nanosSinceMidnight)
+	{
+		TimePoint tp;
+		tp._nanos = nanosSinceMidnight;
+		return tp;
+	}
 
-	inline bool isValid() const {return _valid;}
+	inline int hr() const {return _nanos / NanosPerHour;}
+	inline int min() const {return (_nanos / NanosPerMinute) % 60;}
+	inline int sec() const {return (_nanos / NanosPerSecond) % 60;}
+	inline int millisec() const {return (_nanos / 1000000) % 1000;}
 
-	// hacky but convenient for the time comparison method
-	inline const int* repr() const {return vec;}
+	constexpr int64_t nanos() const {return _nanos;}
+	constexpr bool isValid() const {return _nanos >= 0;}
 
 	string toString() const
 	{
-		char buff[256] = {0};
-		snprintf(buff, sizeof(buff)-1, formatString, hr(), min(), sec(), millisec());
+		char buff[32] = {0};
+		int64_t subSecond = _nanos % NanosPerSecond;
+		// print only as many decimals as the time actually has
+		if(subSecond % 1000000 == 0)
+			snprintf(buff, sizeof(buff)-1, "%02d:%02d:%02d.%03d", hr(), min(), sec(), int(subSecond / 1000000));
+		else if(subSecond % 1000 == 0)
+			snprintf(buff, sizeof(buff)-1, "%02d:%02d:%02d.%06d", hr(), min(), sec(), int(subSecond / 1000));
+		else
+			snprintf(buff, sizeof(buff)-1, "%02d:%02d:%02d.%09d", hr(), min(), sec(), int(subSecond));
 		return buff;
 	}
 
+	// returns Invalid for anything which is not HH:MM:SS optionally followed by 1 to 9 decimals
+	static constexpr int64_t parse(string_view time)
+	{
+		if(time.size() < 8 || time[2] != ':' || time[5] != ':')
+			return Invalid;
+		int hh = 0, mm = 0, ss = 0;
+		if(!_twoDigits(time, 0, hh) || !_twoDigits(time, 3, mm) || !_twoDigits(time, 6, ss) || hh > 23 || mm > 59 || ss > 60)
+			return Invalid;
+		int64_t nanos = hh * NanosPerHour + mm * NanosPerMinute + ss * NanosPerSecond;
+		if(time.size() == 8)
+			return nanos;
+		if(time[8] != '.' || time.size() == 9 || time.size() > 18)
+			return Invalid;
+		int64_t fraction = 0;
+		int64_t scale = NanosPerSecond;
+		for(size_t i=9;i<time.size();i++)
+		{
+			if(time[i] < '0' || time[i] > '9')
+				return Invalid;
+			fraction = fraction * 10 + (time[i] - '0');
+			scale /= 10;
+		}
+		return nanos + fraction * scale;
+	}
+
+	static constexpr int64_t Invalid = -1;
+	static constexpr int64_t NanosPerSecond = 1000000000LL;
+	static constexpr int64_t NanosPerMinute = 60 * NanosPerSecond;
+	static constexpr int64_t NanosPerHour = 60 * NanosPerMinute;
 
 private:
-	constexpr static const char* formatString{"%02d:%02d:%02d.%03d"};
-	bool _valid;
-	int vec[4] = {0};
+	static constexpr bool _twoDigits(string_view s, size_t pos, int& val)
+	{
+		if(s[pos] < '0' || s[pos] > '9' || s[pos+1] < '0' || s[pos+1] > '9')
+			return false;
+		val = (s[pos] - '0') * 10 + (s[pos+1] - '0');
+		return true;
+	}
+
+private:
+	int64_t _nanos;
 };
 
 
 
 inline bool operator<(const TimePoint& lhs, const TimePoint& rhs)
 {
-	for(int i=0;i<4;i++)
-	{
-		if(lhs.repr()[i]<rhs.repr()[i])
-			return true;
-		else if(lhs.repr()[i]>rhs.repr()[i])
-			return false;
-	}
-
-	return true;
+	return lhs.nanos() < rhs.nanos();
 }
 
 inline bool operator<=(const TimePoint& lhs, const TimePoint& rhs)
 {
-	return (lhs<rhs);
+	return lhs.nanos() <= rhs.nanos();
 }
 
 inline bool operator>(const TimePoint& lhs, const TimePoint& rhs)
 {
-	return !(lhs<rhs);
+	return lhs.nanos() > rhs.nanos();
 }
 
 
 inline bool operator==(const TimePoint& lhs, const TimePoint& rhs)
 {
-	for(int i=0;i<4;i++)
-	{
-		if(lhs.repr()[i]!=rhs.repr()[i])
-			return false;
-	}
-	return true;
+	return lhs.nanos() == rhs.nanos();
 }
 
 
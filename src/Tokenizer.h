@@ -2,14 +2,16 @@
 #define _TOKENIZER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <array>
 
 class Tokenizer
 {
 public:
 	Tokenizer(char separator) : _sep(separator) {}
 	~Tokenizer() {}
-	std::vector<std::string> tokenize(const std::string& line) const
+	std::vector<std::string> tokenize(std::string_view line) const
 	{
 		size_t pos = 0;
 		std::vector<std::string> tokenz;
@@ -18,12 +20,30 @@ public:
 			size_t fi = pos;
 			while(fi<line.size() && line[fi]!=_sep)
 				++fi;
-			tokenz.push_back(line.substr(pos, fi-pos));
+			tokenz.emplace_back(line.substr(pos, fi-pos));
 			pos = fi+1;
 		}
 		return tokenz;
 	}
 
+	// allocation free variant for a known number of columns - the fields are views into line
+	// returns the number of fields found, at most N
+	template<size_t N>
+	size_t tokenize(std::string_view line, std::array<std::string_view, N>& fields) const
+	{
+		size_t pos = 0;
+		size_t count = 0;
+		while(pos < line.size() && count < N)
+		{
+			size_t fi = line.find(_sep, pos);
+			if(fi == std::string_view::npos)
+				fi = line.size();
+			fields[count++] = line.substr(pos, fi-pos);
+			pos = fi+1;
+		}
+		return count;
+	}
+
 private:
 	char _sep;
 };
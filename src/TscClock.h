@@ -0,0 +1,64 @@
+#ifndef _TSCCLOCK_H
+#define _TSCCLOCK_H
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+using namespace std;
+
+/*
+ * Cheap timestamps for the hot path: the time stamp counter read with rdtsc, a few ns and no
+ * system call, turned into nanoseconds with a rate calibrated once against steady_clock.
+ * Assumes an invariant TSC synchronised across cores, as on any x86 of the last decade, so
+ * stamps taken on different threads can be subtracted. Elsewhere it falls back to steady_clock
+ * nanos. calibrate() takes a few ms, call it at startup before the pipeline runs - the first
+ * conversion calibrates otherwise.
+ * */
+class TscClock
+{
+public:
+	typedef uint64_t Ticks;
+
+	static inline Ticks now()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __builtin_ia32_rdtsc();
+#else
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	static void calibrate() {_nanosPerTick();}
+
+	static inline double toNanos(Ticks ticks) {return ticks * _nanosPerTick();}
+
+	// from - to, 0 if the stamps are out of order
+	static inline uint64_t nanosBetween(Ticks from, Ticks to) {return to > from ? uint64_t(toNanos(to - from)) : 0;}
+
+	static double ticksPerNano() {return 1.0 / _nanosPerTick();}
+
+private:
+	static double _nanosPerTick()
+	{
+		static const double rate = _measure();
+		return rate;
+	}
+
+	static double _measure()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		auto start = chrono::steady_clock::now();
+		Ticks startTicks = now();
+		std::this_thread::sleep_for(chrono::milliseconds(20));
+		Ticks endTicks = now();
+		auto end = chrono::steady_clock::now();
+		double nanos = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+		return endTicks > startTicks ? nanos / (endTicks - startTicks) : 1.0;
+#else
+		return 1.0;
+#endif
+	}
+};
+
+#endif
@@ -0,0 +1,484 @@
+
+#include "CommonDefs.h"
+#include "Record.h"
+#include "InputReader.h"
+#include "Feed.h"
+#include "MarketDataConsumer.h"
+#include <random>
+
+using namespace std;
+
+Logger LOG("/tmp/MarketDataMergerBenchLog");
+
+/*
+ * Micro benchmarks for the hot paths. Run all of them or name the ones wanted:
+ *   bench [parse] [merge] [topology] [top] ...
+ * */
+
+template<class F>
+double nanosPerOp(size_t ops, F&& f)
+{
+	auto start = chrono::steady_clock::now();
+	f();
+	auto end = chrono::steady_clock::now();
+	return chrono::duration<double, nano>(end - start).count() / ops;
+}
+
+// keeps the optimizer from dropping the work
+volatile double sink;
+
+vector<string> loadLines(const string& file)
+{
+	vector<string> lines;
+	FileInputReader reader(file);
+	string line;
+	while(reader.readLine(line))
+		if(!line.empty())
+			lines.push_back(line);
+	return lines;
+}
+
+/*
+ * Record parsing as it was done with vector<string> tokens and stod/stoi, kept as the baseline
+ * */
+struct LegacyParsedRecord
+{
+	TimePoint time;
+	string 	  symbol;
+	double	  bid;
+	unsigned  bidSize;
+	double	  ask;
+	unsigned  askSize;
+};
+
+LegacyParsedRecord legacyParse(const string& line, const Tokenizer& tokenizer)
+{
+	LegacyParsedRecord rec;
+	vector<string> tokenz = tokenizer.tokenize(line);
+	rec.time = TimePoint(tokenz[0]);
+	rec.symbol = tokenz[1];
+	rec.bid = stod(tokenz[2]);
+	rec.bidSize = stoi(tokenz[3]);
+	rec.ask = stod(tokenz[4]);
+	rec.askSize = stoi(tokenz[5]);
+	return rec;
+}
+
+void benchParse()
+{
+	vector<string> lines = loadLines("../data/feed_a_500lines");
+	const int rounds = 2000;
+	const size_t ops = lines.size() * rounds;
+	Tokenizer tokenizer(',');
+
+	double legacy = nanosPerOp(ops, [&]{
+		double acc = 0;
+		for(int r=0;r<rounds;r++)
+			for(const string& line : lines)
+			{
+				LegacyParsedRecord rec = legacyParse(line, tokenizer);
+				acc += rec.bid + rec.askSize;
+			}
+		sink = acc;
+	});
+
+	SymbolCache symbols;
+	double current = nanosPerOp(ops, [&]{
+		double acc = 0;
+		for(int r=0;r<rounds;r++)
+			for(const string& line : lines)
+			{
+				Record rec(line, tokenizer, symbols, 0, TscClock::now());
+				acc += rec.Bid() + rec.AskSize();
+			}
+		sink = acc;
+	});
+
+	cout << "parse: " << ops << " lines, legacy " << legacy << " ns/line, current " << current << " ns/line\n";
+}
+
+/*
+ * Serves lines out of memory without copying, so the merge benchmark measures parsing and merging only
+ * */
+class VectorInputReader : public InputReader
+{
+public:
+	VectorInputReader(const vector<string>& lines) : _lines(lines) {}
+	bool readLine(string& line)
+	{
+		string_view view;
+		bool res = readLineView(view);
+		line = view;
+		return res;
+	}
+	bool readLineView(string_view& line)
+	{
+		if(_next >= _lines.size())
+		{
+			_valid = false;
+			line = string_view();
+			return false;
+		}
+		line = _lines[_next++];
+		_entriesRead++;
+		return true;
+	}
+private:
+	const vector<string>& _lines;
+	size_t				  _next{0};
+};
+
+/*
+ * The merge as it was, scanning every feed for each record, kept as the baseline
+ * */
+class LinearScanMerge
+{
+public:
+	void addFeed(const FeedPtr& feed) {_feeds.push_back(feed);}
+	RecordPtr nextRecord()
+	{
+		RecordPtr oldestRecord{nullptr};
+		TimePoint oldestTime;
+		int		  oldestFeedIndex = 0;
+		for(int i=0;i<_feeds.size();i++)
+		{
+			FeedPtr& feed = _feeds[i];
+			if(feed->isValid())
+			{
+				TimePoint time;
+				if(feed->cache()!=nullptr)
+					time = feed->cache()->Time();
+				else if(feed->readNextRecordToCache())
+					time = feed->cache()->Time();
+
+				if(!oldestTime.isValid() || oldestTime>time)
+				{
+					oldestTime = time;
+					oldestFeedIndex = i;
+				}
+			}
+		}
+		if(oldestTime.isValid())
+		{
+			oldestRecord = _feeds[oldestFeedIndex]->cache();
+			_feeds[oldestFeedIndex]->clearCache();
+		}
+		return oldestRecord;
+	}
+private:
+	vector<FeedPtr> _feeds;
+};
+
+vector<vector<string>> generateFeeds(int feedCount, int totalLines)
+{
+	std::mt19937 rng(feedCount);
+	vector<vector<string>> feeds(feedCount);
+	for(auto& lines : feeds)
+	{
+		int64_t millis = 9*3600*1000;
+		for(int i=0;i<totalLines/feedCount;i++)
+		{
+			millis += rng() % 5;
+			lines.push_back(TimePoint::fromNanos(millis*1000000).toString() + ",SPY,205.24,1138,205.25,406");
+		}
+	}
+	return feeds;
+}
+
+template<class Merge>
+double mergeNanosPerRecord(const vector<vector<string>>& lines)
+{
+	Merge merge;
+	for(size_t i=0;i<lines.size();i++)
+		merge.addFeed(FeedPtr(new Feed(InputReaderPtr(new VectorInputReader(lines[i])), i)));
+	size_t records = 0;
+	auto start = chrono::steady_clock::now();
+	while(RecordPtr rec = merge.nextRecord())
+	{
+		RecordPool::release(rec);
+		records++;
+	}
+	auto end = chrono::steady_clock::now();
+	return chrono::duration<double, nano>(end - start).count() / records;
+}
+
+void benchMerge()
+{
+	const int totalLines = 1 << 18;
+	cout << "merge: " << totalLines << " records, ns/record including parsing\n";
+	cout << "feeds\tlinear\tloser tree\n";
+	for(int feeds=2;feeds<=1024;feeds*=2)
+	{
+		vector<vector<string>> lines = generateFeeds(feeds, totalLines);
+		double linear = mergeNanosPerRecord<LinearScanMerge>(lines);
+		double tree = mergeNanosPerRecord<ConsolidatedFeed>(lines);
+		cout << feeds << "\t" << linear << "\t" << tree << "\n";
+	}
+}
+
+// the top of book sweep goes up to this many feeds
+constexpr size_t TopOfBookFeeds = MaxFeeds < 1024 ? MaxFeeds : 1024;
+
+struct alignas(64) RescanQuotes
+{
+	Price	 price[TopOfBookFeeds];
+	unsigned qty[TopOfBookFeeds];
+};
+
+
+/*
+ * The top level as it was, bitmasks of the feeds at the best price and a scan over all feeds once
+ * the last of them leaves, kept as the baseline
+ * */
+class RescanTopLevel
+{
+public:
+	RescanTopLevel() {}
+	const Side& Bid() const {return _totalBid;}
+	const Side& Ask() const {return _totalAsk;}
+
+	unsigned int BidCount() const {return _bidFeeds.count();}
+	unsigned int AskCount() const {return _askFeeds.count();}
+
+	bool feedInvolved(FeedID feedid, SideEnum s) const
+	{
+		return s == SideEnum::Bid ? _bidFeeds.test(feedid) : _askFeeds.test(feedid);
+	}
+
+	// the feed's quote in quotes replaced one with oldQty, present are the feeds which quoted so far
+	void update(FeedID feedid, unsigned oldQty, const RescanQuotes& quotes, const FeedMask& present, SideEnum s)
+	{
+		if(s == SideEnum::Bid)
+			_update(feedid, oldQty, quotes, present, _bidFeeds, _totalBid, [](Price a, Price b){return a > b;});
+		else
+			_update(feedid, oldQty, quotes, present, _askFeeds, _totalAsk, [](Price a, Price b){return a < b;});
+	}
+
+private:
+	template<class Better>
+	static void _update(FeedID feedid, unsigned oldQty, const RescanQuotes& quotes, const FeedMask& present,
+						FeedMask& top, Side& total, Better better)
+	{
+		Price price = quotes.price[feedid];
+		unsigned qty = quotes.qty[feedid];
+		if(top.test(feedid))
+		{
+			if(price == total.price())
+				total.update(price, total.qty() - oldQty + qty);
+			else if(better(price, total.price()))
+			{
+				top.only(feedid);
+				total = Side(price, qty);
+			}
+			else
+			{
+				top.reset(feedid);
+				if(top.none())
+					_rescan(quotes, present, top, total, better);
+				else
+					total.update(total.price(), total.qty() - oldQty);
+			}
+		}
+		else if(top.none() || better(price, total.price()))
+		{
+			top.only(feedid);
+			total = Side(price, qty);
+		}
+		else if(price == total.price())
+		{
+			top.set(feedid);
+			total.update(price, total.qty() + qty);
+		}
+	}
+
+	template<class Better>
+	static void _rescan(const RescanQuotes& quotes, const FeedMask& present, FeedMask& top, Side& total, Better better)
+	{
+		top.clear();
+		total = Side(0, 0);
+		present.forEach([&](size_t feed){
+			Price price = quotes.price[feed];
+			if(top.none() || better(price, total.price()))
+			{
+				top.only(feed);
+				total = Side(price, quotes.qty[feed]);
+			}
+			else if(price == total.price())
+			{
+				top.set(feed);
+				total.update(price, total.qty() + quotes.qty[feed]);
+			}
+		});
+	}
+
+private:
+	Side	 _totalBid;
+	Side	 _totalAsk;
+	FeedMask _bidFeeds;
+	FeedMask _askFeeds;
+};
+
+struct Quote
+{
+	FeedID	 feed;
+	Price	 bid;
+	unsigned bidSize;
+	Price	 ask;
+	unsigned askSize;
+};
+
+// every feed's prices walk a tick at a time around the same level, so the best price keeps changing hands
+vector<Quote> generateTopOfBookQuotes(int feedCount, int count)
+{
+	std::mt19937 rng(feedCount);
+	vector<Price> mid(feedCount, 2052400);
+	vector<Quote> quotes;
+	for(int i=0;i<count;i++)
+	{
+		FeedID feed = rng() % feedCount;
+		mid[feed] += 100 * (int(rng() % 3) - 1);
+		Price spread = 100 * (1 + rng() % 2);
+		quotes.push_back(Quote{feed, mid[feed] - spread, unsigned(1 + rng() % 500), mid[feed] + spread, unsigned(1 + rng() % 500)});
+	}
+	return quotes;
+}
+
+// worst case for a scan: the feeds take turns to improve the best price and to fall back from it
+vector<Quote> generateLeaderQuotes(int feedCount, int count)
+{
+	vector<Quote> quotes;
+	for(int i=0;i<count;i++)
+	{
+		FeedID feed = (i/2) % feedCount;
+		Price offset = i % 2 == 0 ? 100 : -100*(1 + feed % 3);
+		quotes.push_back(Quote{feed, 2052400 + offset, 100, 2052500 - offset, 100});
+	}
+	return quotes;
+}
+
+pair<double, double> topOfBookNanosPerQuote(const vector<Quote>& quotes)
+{
+	const size_t count = quotes.size();
+	double rescan = nanosPerOp(count, [&]{
+		RescanTopLevel top;
+		FeedMask present;
+		RescanQuotes bids{}, asks{};
+		Price acc = 0;
+		for(const Quote& q : quotes)
+		{
+			unsigned oldBidQty = bids.qty[q.feed];
+			unsigned oldAskQty = asks.qty[q.feed];
+			bids.price[q.feed] = q.bid;
+			bids.qty[q.feed] = q.bidSize;
+			asks.price[q.feed] = q.ask;
+			asks.qty[q.feed] = q.askSize;
+			present.set(q.feed);
+			top.update(q.feed, oldBidQty, bids, present, SideEnum::Bid);
+			top.update(q.feed, oldAskQty, asks, present, SideEnum::Ask);
+			acc += top.Bid().price() + top.Ask().qty();
+		}
+		sink = acc;
+	});
+	double tree = nanosPerOp(count, [&]{
+		TopLevel top;
+		Price acc = 0;
+		for(const Quote& q : quotes)
+		{
+			top.update(q.feed, Side(q.bid, q.bidSize), SideEnum::Bid);
+			top.update(q.feed, Side(q.ask, q.askSize), SideEnum::Ask);
+			acc += top.Bid().price() + top.Ask().qty();
+		}
+		sink = acc;
+	});
+	return make_pair(rescan, tree);
+}
+
+void benchTopOfBook()
+{
+	const int count = 1 << 20;
+	cout << "top of book: " << count << " quotes of one symbol, ns/quote, random walk and feeds taking turns to lead\n";
+	cout << "feeds\twalk rescan\twalk tree\tlead rescan\tlead tree\n";
+	for(int feeds=2;feeds<=int(TopOfBookFeeds);feeds*=2)
+	{
+		pair<double, double> walk = topOfBookNanosPerQuote(generateTopOfBookQuotes(feeds, count));
+		pair<double, double> lead = topOfBookNanosPerQuote(generateLeaderQuotes(feeds, count));
+		cout << feeds << "\t" << walk.first << "\t" << walk.second << "\t" << lead.first << "\t" << lead.second << "\n";
+	}
+}
+
+// quotes over symbolCount symbols with prices moving a tick at a time, so the top of book keeps changing
+vector<vector<string>> generateQuotes(int feedCount, int totalLines, int symbolCount)
+{
+	std::mt19937 rng(feedCount * symbolCount);
+	vector<vector<string>> feeds(feedCount);
+	for(auto& lines : feeds)
+	{
+		int64_t millis = 9*3600*1000;
+		for(int i=0;i<totalLines/feedCount;i++)
+		{
+			millis += rng() % 5;
+			int ticks = 20000 + rng() % 100;
+			lines.push_back(TimePoint::fromNanos(millis*1000000).toString() + ",SYM" + to_string(rng() % symbolCount)
+							+ "," + to_string(ticks / 100) + "." + to_string(ticks % 100) + ",100,"
+							+ to_string((ticks+1) / 100) + "." + to_string((ticks+1) % 100) + ",100");
+		}
+	}
+	return feeds;
+}
+
+// runs the whole pipeline from the feeds to the reporter and prints the top of book update latencies
+void topologyLatency(const vector<vector<string>>& lines, int processors, MarketDataConsumer::Routing routing)
+{
+	ReporterPtr reporter{new StandardOutputReporter()};
+	MarketDataConsumerPtr consumer{new MarketDataConsumer(processors, reporter, routing)};
+	FeedManager feeds;
+	for(size_t i=0;i<lines.size();i++)
+		feeds.addFeed(FeedPtr(new Feed(InputReaderPtr(new VectorInputReader(lines[i])), i)));
+	feeds.registerNewRecordCB(std::bind(&MarketDataConsumer::push, consumer, placeholders::_1));
+
+	auto start = chrono::steady_clock::now();
+	consumer->start();
+	feeds.start();
+	feeds.join();
+	consumer->join();
+	auto end = chrono::steady_clock::now();
+	reporter->requestStop();
+	reporter->join();
+
+	LatencyHistogram latencies = consumer->getLatencies();
+	cout << (routing == MarketDataConsumer::Routing::Direct ? "direct" : "multiplexed") << "\t"
+		 << latencies.count() << "\t" << latencies.p50() << "\t" << latencies.p90() << "\t" << latencies.p99() << "\t"
+		 << latencies.max() << "\t" << chrono::duration<double, milli>(end - start).count() << "\n";
+}
+
+void benchTopology()
+{
+	const int totalLines = 1 << 18;
+	const int processors = 4;
+	vector<vector<string>> lines = generateQuotes(4, totalLines, 64);
+	cout << "topology: " << totalLines << " records, " << processors << " processors, top of book update latency in microsec\n";
+	cout << "routing\tupdates\tp50\tp90\tp99\tmax\tms\n";
+	topologyLatency(lines, processors, MarketDataConsumer::Routing::Multiplexed);
+	topologyLatency(lines, processors, MarketDataConsumer::Routing::Direct);
+}
+
+int main(int argc, char** argv)
+{
+	vector<pair<string, function<void()>>> benchmarks{
+		{"parse", benchParse},
+		{"merge", benchMerge},
+		{"topology", benchTopology},
+		{"top", benchTopOfBook}
+	};
+
+	for(const auto& b : benchmarks)
+	{
+		bool selected = argc < 2;
+		for(int i=1;i<argc;i++)
+			if(b.first == argv[i])
+				selected = true;
+		if(selected)
+			b.second();
+	}
+	return 0;
+}
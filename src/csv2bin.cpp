@@ -0,0 +1,29 @@
+#include "BinaryFormat.h"
+
+using namespace std;
+
+Logger LOG("/tmp/Csv2BinLog");
+
+/*
+ * Converts CSV captures to the binary format the bin: reader replays:
+ *   csv2bin in.csv out.bin
+ * */
+int main(int argc, char** argv)
+{
+	if(argc != 3)
+	{
+		cerr << "usage: csv2bin in.csv out.bin\n";
+		return 1;
+	}
+	try
+	{
+		uint64_t records = convertCsvToBinary(argv[1], argv[2]);
+		cout << "wrote " << records << " records of " << SymbolTable::instance().size() << " symbols to " << argv[2] << "\n";
+	}
+	catch(const exception& e)
+	{
+		cerr << e.what() << "\n";
+		return 1;
+	}
+	return 0;
+}
@@ -3,8 +3,11 @@
 #include "Feed.h"
 #include "Book.h"
 #include "InputReader.h"
+#include "GzipInputReader.h"
 #include "Logger.h"
 #include "MarketDataConsumer.h"
+#include "Config.h"
+#include <sys/resource.h>
 
 using namespace std;
 
@@ -13,17 +16,35 @@ Logger LOG("/tmp/MarketDataMergerLog");
 class MainApp
 {
 public:
-	MainApp(vector<string> inputFiles, int processingGroupCount) : _reporter(ReporterPtr(new KnowsAboutFeedsStandardOutputReporter(inputFiles.size()))),
-													_consumer(new MarketDataConsumer(processingGroupCount, _reporter))
+	// everything which can reject the config comes before the first thread is started
+	MainApp(const Config& config) : _rates(_readRates(config)),
+									_reporter(ReporterPtr(new KnowsAboutFeedsStandardOutputReporter(config.processors, _createSink(config.output),
+														config.conflate ? Reporter::Publication::Conflated : Reporter::Publication::Queued))),
+													_consumer(new MarketDataConsumer(config.processors, _reporter,
+														config.directRouting ? MarketDataConsumer::Routing::Direct : MarketDataConsumer::Routing::Multiplexed,
+														config.threads))
 	{
+		// before any record is stamped
+		TscClock::calibrate();
+		_reporter->place(config.threads.reporter());
+		LOG.place(config.threads.logger());
+		LOG.setLevel(config.logLevel);
+		_feed.setThreadLayout(config.threads);
+		_partitionSymbols(config);
+		if(config.rebalanceMillis > 0)
+			_consumer->enableRebalancer(chrono::milliseconds(config.rebalanceMillis));
 
 		FeedID feedid = 0;
-		for(const string& file : inputFiles)
+		for(const string& file : config.feeds)
 		{
-			FeedPtr feed{new Feed(InputReaderPtr(new FileInputReader(file)), feedid)};
+			InputReaderPtr input{new LazyInputReader([file]{return _createInputReader(file);})};
+			FeedPtr feed{new Feed(input, feedid)};
 			_feed.addFeed(std::move(feed));
 			feedid++;
 		}
+		_checkDescriptorLimit(config.feeds);
+		if(config.readerThreads > 0)
+			_feed.enableReadAhead(config.readerThreads, config.readAheadDepth);
 		_feed.registerNewRecordCB(std::bind(&MarketDataConsumer::push, _consumer, placeholders::_1));
 	}
 	~MainApp() {}
@@ -39,9 +60,120 @@ public:
 
 		// report different statistics
 		_reportBookStatistics();
+		_reportProcessorLoad();
+		_reportStageLatencies();
+		if(!_saveRatesFile.empty())
+			_saveRates();
 	}
 
 private:
+	static unique_ptr<TopOfBookSink> _createSink(const string& output)
+	{
+		if(output.empty())
+			return nullptr;
+		return unique_ptr<TopOfBookSink>(new TopOfBookSink(output));
+	}
+
+	// a feed is given as [reader:]path, e.g. mmap:/data/feed_a.csv, bin:/data/feed_a.bin or gz:/data/feed_a.csv.gz
+	// plain and gz: feeds each hold a descriptor for the whole merge, mmap: and bin: feeds none
+	static void _checkDescriptorLimit(const vector<string>& feeds)
+	{
+		size_t holding = count_if(feeds.begin(), feeds.end(), [](const string& feed) {
+			return feed.compare(0, 5, "mmap:") != 0 && feed.compare(0, 4, "bin:") != 0;
+		});
+		struct rlimit limit;
+		if(::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && holding + DescriptorsInUse > limit.rlim_cur)
+			cerr << "warning: " << holding << " feeds keep a file open but the descriptor limit is " << limit.rlim_cur
+				 << ", read them as mmap: or bin: feeds\n";
+	}
+
+	static InputReaderPtr _createInputReader(const string& feedSpec)
+	{
+		const string mmapPrefix{"mmap:"};
+		const string binaryPrefix{"bin:"};
+		const string gzipPrefix{"gz:"};
+		if(feedSpec.compare(0, mmapPrefix.size(), mmapPrefix) == 0)
+			return InputReaderPtr(new MmapFileInputReader(feedSpec.substr(mmapPrefix.size())));
+		if(feedSpec.compare(0, binaryPrefix.size(), binaryPrefix) == 0)
+			return InputReaderPtr(new BinaryFileInputReader(feedSpec.substr(binaryPrefix.size())));
+		if(feedSpec.compare(0, gzipPrefix.size(), gzipPrefix) == 0)
+			return InputReaderPtr(new GzipInputReader(feedSpec.substr(gzipPrefix.size())));
+		return InputReaderPtr(new FileInputReader(feedSpec));
+	}
+
+	static SymbolRates _readRates(const Config& config)
+	{
+		if(config.ratesFile.empty())
+			return SymbolRates();
+		return readSymbolRates(config.ratesFile);
+	}
+
+	void _partitionSymbols(const Config& config)
+	{
+		PartitionerPtr partitioner;
+		if(config.loadAwarePartition)
+			partitioner.reset(new LoadAwarePartitioner());
+		else
+			partitioner.reset(new HashPartitioner());
+		_consumer->setPartition(partitioner->partition(_rates, config.processors));
+		_saveRatesFile = config.saveRatesFile;
+	}
+
+	void _reportProcessorLoad()
+	{
+		const vector<double>& planned = _consumer->partition().plannedLoad();
+		vector<size_t> messages = _consumer->getProcessorMessageCounts();
+		double plannedTotal = 0.0;
+		size_t messageTotal = 0;
+		for(size_t i=0;i<messages.size();i++)
+		{
+			plannedTotal += planned[i];
+			messageTotal += messages[i];
+		}
+		cout << "\nProcessor load, share of the configured rates and of the records processed:\n";
+		for(size_t i=0;i<messages.size();i++)
+		{
+			cout << "Processor " << i;
+			if(plannedTotal > 0.0)
+				cout << ",PlannedShare " << 100.0 * planned[i] / plannedTotal << "%";
+			cout << ",Messages " << messages[i];
+			if(messageTotal > 0)
+				cout << ",Share " << 100.0 * messages[i] / messageTotal << "%";
+			cout << "\n";
+		}
+		cout << "Symbols migrated between processors: " << _consumer->migrationCount() << "\n";
+		if(_reporter->isConflating())
+			cout << "Top of book changes conflated by the reporter: " << _reporter->conflatedCount() << "\n";
+	}
+
+	void _reportStageLatencies()
+	{
+		cout << "\nLatency(nanosec) of each stage per processor, the time since the previous stage - p50/p99/max:\n";
+		vector<StageLatencies> perProcessor = _consumer->getStageLatencies();
+		auto summary = [](const LatencyHistogram& h) {
+			return to_string(h.p50()) + "/" + to_string(h.p99()) + "/" + to_string(h.max());
+		};
+		for(size_t i=0;i<perProcessor.size();i++)
+		{
+			const StageLatencies& stages = perProcessor[i];
+			if(stages.total().count() == 0)
+				continue;
+			cout << "Processor " << i << ",Records " << stages.total().count();
+			for(size_t s=0;s<StageLatencies::Intervals;s++)
+				if(stages.interval(s).count() > 0)
+					cout << "," << StageLatencies::intervalName(s) << " " << summary(stages.interval(s));
+			cout << ",total " << summary(stages.total()) << "\n";
+		}
+	}
+
+	void _saveRates()
+	{
+		SymbolRates rates;
+		for(const auto& p : _consumer->getBookStatistics())
+			rates[p.first] = p.second.MessageCount();
+		writeSymbolRates(_saveRatesFile, rates);
+	}
+
 	void _reportBookStatistics()
 	{
 		cout << "\n+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++\n";
@@ -49,35 +181,66 @@ private:
 		cout << "Latency(microsec) on market update changing the top of the book.\n";
 		cout << "Latency(microsec) is measured from first reading the market data entry from one of the feeds until the point we updated the book.\n";
 		cout << "\n";
-		unordered_map<string, BookStatistics> bookstats = _consumer->getBookStatistics();
+		unordered_map<SymbolID, BookStatistics> bookstats = _consumer->getBookStatistics();
 		for(auto& p : bookstats)
 		{
-			p.second.sortLatencies();
 			cout << p.second.toString() << endl;
 		}
+		_reportLatencySummary();
 		cout << "\nEnd of Book Statistics\n";
 		cout << "+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++\n";
 	}
 
+	void _reportLatencySummary()
+	{
+		LatencyHistogram latencies = _consumer->getLatencies();
+		bool direct = _consumer->routing() == MarketDataConsumer::Routing::Direct;
+		cout << "\nAll symbols, " << (direct ? "direct" : "multiplexed") << " routing: ";
+		if(latencies.count() == 0)
+		{
+			cout << "no top of book updates\n";
+			return;
+		}
+		cout << "UpdateCount " << latencies.count() << ",AvgLatency " << latencies.mean() << ",MedianLatency " << latencies.p50() << ",P90Latency " << latencies.p90()
+			 << ",P99Latency " << latencies.p99() << ",P999Latency " << latencies.p999() << ",MaxLatency " << latencies.max() << "\n";
+	}
+
 private:
+	// stdio, the log, the sink and whatever the threads open besides the feeds
+	static constexpr size_t					DescriptorsInUse = 32;
+
+	SymbolRates								_rates;
 	ReporterPtr								_reporter;
 	FeedManager 							_feed;
 	MarketDataConsumerPtr 					_consumer;
+	string									_saveRatesFile;
 };
 
 
 
 int main(int argc, char** argv)
 {
-	auto start = chrono::system_clock::now();
-	vector<string> infiles;
-	for(int i=1;i<argc;i++)
+	Config config;
+	try
+	{
+		config = Config::fromCommandLine(argc, argv);
+	}
+	catch(const invalid_argument& e)
 	{
-		infiles.push_back(argv[i]);
+		cerr << e.what() << "\n" << Config::usage();
+		return 1;
 	}
 
-	MainApp app(infiles, 6);
-	app.start();
+	try
+	{
+		MainApp app(config);
+		app.start();
+	}
+	catch(const invalid_argument& e)
+	{
+		cerr << e.what() << "\n";
+		return 1;
+	}
 
 	return 0;
 }
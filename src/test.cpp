@@ -2,11 +2,25 @@
 #include "InputReader.h"
 #include "Feed.h"
 #include "Book.h"
+#include "SPSCRingBuffer.h"
+#include "MPSCRingBuffer.h"
+#include "ConflatingQueue.h"
+#include "SpinningQueue.h"
+#include "MarketDataConsumer.h"
+#include "Config.h"
+#include "Partitioner.h"
+#include "GzipInputReader.h"
+#include "OutputSink.h"
 #include <gtest/gtest.h>
 #include <iostream>
+#include <random>
+#include <tuple>
+#include <iomanip>
 
 using namespace std;
 
+Logger LOG("/tmp/MarketDataMergerTestLog");
+
 using CompositeTopLevel = CompositeBook::CompositeTopLevel;
 
 TEST(Tokenizer,tokenize)
@@ -23,6 +37,49 @@ TEST(Tokenizer,tokenize)
 	ASSERT_EQ("406",tokz[5]);
 }
 
+TEST(Tokenizer,tokenizeFixedArity)
+{
+	Tokenizer tokenizer(',');
+	string s{"09:00:00.007,SPY,205.24,1138,205.25,406"};
+	array<string_view, 6> tokz;
+	ASSERT_EQ(6,tokenizer.tokenize(s, tokz));
+	ASSERT_EQ("09:00:00.007",tokz[0]);
+	ASSERT_EQ("SPY",tokz[1]);
+	ASSERT_EQ("205.24",tokz[2]);
+	ASSERT_EQ("1138",tokz[3]);
+	ASSERT_EQ("205.25",tokz[4]);
+	ASSERT_EQ("406",tokz[5]);
+
+	array<string_view, 6> truncated;
+	ASSERT_EQ(3,tokenizer.tokenize(string_view("09:00:00.007,SPY,205.24"), truncated));
+}
+
+TEST(NumberParser, matchesStdConversions)
+{
+	vector<string> prices{"205.24", "39.2", "117.09", "0.5", "1", "17.615", "1234.1234", "-3.25"};
+	for(const string& p : prices)
+	{
+		Price parsed = 0;
+		ASSERT_EQ(true, NumberParser::parsePrice(p, parsed));
+		ASSERT_EQ(priceFromDouble(stod(p)), parsed);
+	}
+	unsigned int size = 0;
+	ASSERT_EQ(true, NumberParser::parseUnsigned("49524", size));
+	ASSERT_EQ(49524, size);
+	ASSERT_EQ(true, NumberParser::parseUnsigned("4294967295", size));
+	ASSERT_EQ(4294967295u, size);
+
+	Price price = 0;
+	ASSERT_EQ(false, NumberParser::parsePrice("205.123456789", price));	// finer than a tick
+	ASSERT_EQ(false, NumberParser::parsePrice("", price));
+	ASSERT_EQ(false, NumberParser::parsePrice(".", price));
+	ASSERT_EQ(false, NumberParser::parsePrice("205.2x", price));
+	ASSERT_EQ(false, NumberParser::parsePrice("20 5.24", price));
+	ASSERT_EQ(false, NumberParser::parseUnsigned("", size));
+	ASSERT_EQ(false, NumberParser::parseUnsigned("12a", size));
+	ASSERT_EQ(false, NumberParser::parseUnsigned("4294967296", size));
+}
+
 
 class BlockingQueueTest : public testing::Test
 {
@@ -142,6 +199,181 @@ TEST_F(BlockingQueueTest, elemCount)
 }
 
 
+TEST(SPSCRingBuffer, transfersInOrder)
+{
+	SPSCRingBuffer<int> ring(1000);
+	ASSERT_EQ(1024, ring.capacity());
+	const int count = 1000000;
+	thread producer([&ring]{
+		for(int i=0;i<count;i++)
+			ring.push(i);
+		ring.requestStop();
+	});
+	int expected = 0;
+	int val = -1;
+	while(ring.pop(val))
+	{
+		ASSERT_EQ(expected, val);
+		expected++;
+	}
+	producer.join();
+	ASSERT_EQ(count, expected);
+}
+
+TEST(SPSCRingBuffer, constructsInPlace)
+{
+	SPSCRingBuffer<string> ring(2);
+	ASSERT_EQ(true, ring.tryEmplace(40, 'x'));
+	ASSERT_EQ(true, ring.tryPush("SPY"));
+	ASSERT_EQ(false, ring.tryPush("QQQ"));
+	string val;
+	ASSERT_EQ(true, ring.tryPop(val));
+	ASSERT_EQ(string(40, 'x'), val);
+	ASSERT_EQ(true, ring.tryEmplace("IWM"));
+	ASSERT_EQ(2, ring.size());
+	// the remaining elements are destroyed with the ring
+}
+
+TEST(MPSCRingBuffer, keepsEachProducersOrder)
+{
+	MPSCRingBuffer<pair<int, int>> ring(100);
+	ASSERT_EQ(128, ring.capacity());
+	const int producers = 4;
+	const int count = 200000;
+	vector<thread> threads;
+	for(int p=0;p<producers;p++)
+		threads.emplace_back([&ring, p]{
+			for(int i=0;i<count;i++)
+				ring.publish([p, i](pair<int, int>& slot){slot = make_pair(p, i);});
+		});
+	vector<int> expected(producers, 0);
+	int total = 0;
+	pair<int, int> val;
+	while(total < producers*count)
+	{
+		ASSERT_EQ(true, ring.pop(val));
+		ASSERT_EQ(expected[val.first]++, val.second);
+		++total;
+	}
+	for(auto& t : threads)
+		t.join();
+	ASSERT_EQ(true, ring.isEmpty());
+	ring.requestStop();
+	ASSERT_EQ(false, ring.pop(val));
+
+	// a single slot is not enough to tell full from empty
+	MPSCRingBuffer<int> tiny(1);
+	ASSERT_EQ(2, tiny.capacity());
+	int out;
+	for(int i=0;i<5;i++)
+	{
+		tiny.push(i);
+		ASSERT_EQ(true, tiny.tryPop(out));
+		ASSERT_EQ(i, out);
+		ASSERT_EQ(false, tiny.tryPop(out));
+	}
+}
+
+// pair is not trivially copyable
+struct SymbolValue
+{
+	SymbolID symbol;
+	int		 value;
+	bool operator==(const SymbolValue& other) const {return symbol == other.symbol && value == other.value;}
+};
+
+TEST(ConflatingQueue, newestValuePerSymbol)
+{
+	ConflatingQueue<SymbolValue> queue(16);
+	for(int i=0;i<100;i++)
+		queue.push(i % 3, SymbolValue{SymbolID(i % 3), i});
+	queue.push(InvalidSymbolID, SymbolValue{});
+	// still pending, so it comes ahead of the marker
+	queue.push(0, SymbolValue{0, 100});
+	ASSERT_EQ(98u, queue.conflatedCount());
+
+	vector<SymbolValue> seen;
+	auto read = [&seen](const SymbolValue& val) {seen.push_back(val);};
+	ASSERT_EQ(4u, queue.consume(read, 10));
+	vector<SymbolValue> expected{{0, 100}, {1, 97}, {2, 98}, {0, 0}};
+	ASSERT_EQ(expected, seen);
+	ASSERT_EQ(true, queue.isEmpty());
+
+	// a consumer which keeps up sees every value
+	const int producers = 3;
+	const int count = 100000;
+	ConflatingQueue<SymbolValue> shared(64);
+	vector<thread> threads;
+	for(int p=0;p<producers;p++)
+		threads.emplace_back([&shared, p]{
+			for(int i=1;i<=count;i++)
+				shared.push(5000 + p, SymbolValue{SymbolID(5000 + p), i});
+			shared.push(InvalidSymbolID, SymbolValue{});
+		});
+	vector<int> last(producers, 0);
+	int ended = 0;
+	size_t received = 0;
+	auto check = [&](const SymbolValue& val) {
+		if(val.symbol == 0 && val.value == 0)
+		{
+			++ended;
+			return;
+		}
+		int& previous = last[val.symbol - 5000];
+		ASSERT_LE(previous, val.value);
+		previous = val.value;
+		++received;
+	};
+	while(ended < producers)
+		shared.consume(check, 64);
+	for(auto& t : threads)
+		t.join();
+	// nothing lost after the end markers
+	shared.consume(check, 64);
+	ASSERT_EQ(vector<int>(producers, count), last);
+	ASSERT_EQ(size_t(producers) * count, received + shared.conflatedCount());
+}
+
+template<class Q>
+void assertBatchTransfer(Q& queue)
+{
+	const int count = 100000;
+	thread producer([&queue]{
+		vector<int> batch;
+		for(int i=0;i<count;i++)
+		{
+			batch.push_back(i);
+			if(batch.size() == 37 || i == count-1)
+			{
+				queue.pushBatch(batch.begin(), batch.end());
+				batch.clear();
+			}
+		}
+		queue.requestStop();
+	});
+	vector<int> drained;
+	int expected = 0;
+	while(queue.drainTo(drained, 100) > 0)
+	{
+		ASSERT_LE(drained.size(), 100);
+		for(int val : drained)
+			ASSERT_EQ(expected++, val);
+		drained.clear();
+	}
+	producer.join();
+	ASSERT_EQ(count, expected);
+}
+
+TEST(Queue, batchPushAndDrain)
+{
+	BlockingQueue<int> blocking;
+	assertBatchTransfer(blocking);
+	SpinningQueue<int> spinning;
+	assertBatchTransfer(spinning);
+	SPSCRingBuffer<int> ring(64);
+	assertBatchTransfer(ring);
+}
+
 TEST(MockInputReader, data)
 {
 	vector<string> feed {"09:00:00.007,SPY,205.24,1138,205.25,406", "09:00:00.008,SPY,205.24,1138,205.25,406",
@@ -161,6 +393,264 @@ TEST(MockInputReader, data)
 	ASSERT_EQ(3, reader.numOfEntriesRead());
 }
 
+TEST(MmapFileInputReader, sameLinesAsFileInputReader)
+{
+	string path{"/tmp/MarketDataMergerMmapTest.csv"};
+	{
+		ofstream out(path);
+		out << "time,symbol,bid,bid_size,ask,ask_size\n";
+		out << "09:00:00.007,SPY,205.24,1138,205.25,406\n";
+		out << "09:00:00.008,EEM,39.2,49524,39.21,7413\n";
+		out << "09:00:00.008,SPY,205.24,400,205.25,1306";	// no trailing newline
+	}
+
+	FileInputReader fileReader{path};
+	MmapFileInputReader mmapReader{path};
+	string expected;
+	string_view line;
+	while(fileReader.readLine(expected))
+	{
+		ASSERT_EQ(true, mmapReader.readLineView(line));
+		ASSERT_EQ(expected, line);
+	}
+	ASSERT_EQ(false, mmapReader.readLineView(line));
+	ASSERT_EQ(false, mmapReader.isValid());
+	ASSERT_EQ(3, mmapReader.numOfEntriesRead());
+	remove(path.c_str());
+}
+
+TEST(BinaryFileInputReader, sameRecordsAsTheCsv)
+{
+	string csv{"/tmp/MarketDataMergerBinaryTest.csv"};
+	string bin{"/tmp/MarketDataMergerBinaryTest.bin"};
+	{
+		ofstream out(csv);
+		out << "time,symbol,bid,bid_size,ask,ask_size\n";
+		out << "09:00:00.007,SPY,205.24,1138,205.25,406\n";
+		out << "09:00:00.008,EEM,39.2,49524,39.21,7413\n";
+		out << "not a record\n";
+		out << "09:00:00.008123,SPY,205.24,400,205.25,1306\n";
+	}
+	ASSERT_EQ(3u, convertCsvToBinary(csv, bin));
+
+	Feed csvFeed(InputReaderPtr(new FileInputReader(csv)), 0);
+	Feed binFeed(InputReaderPtr(new LazyInputReader([bin]{return InputReaderPtr(new BinaryFileInputReader(bin));})), 0);
+	int count = 0;
+	while(csvFeed.readNextValidRecordToCache())
+	{
+		ASSERT_EQ(true, binFeed.readNextValidRecordToCache());
+		ASSERT_EQ(csvFeed.cache()->toString(), binFeed.cache()->toString());
+		ASSERT_EQ(csvFeed.cache()->Symbolid(), binFeed.cache()->Symbolid());
+		RecordPool::release(csvFeed.cache());
+		RecordPool::release(binFeed.cache());
+		++count;
+	}
+	ASSERT_EQ(3, count);
+	ASSERT_EQ(false, binFeed.readNextValidRecordToCache());
+
+	// not a binary capture
+	BinaryFileInputReader notBinary(csv);
+	ASSERT_EQ(false, notBinary.isValid());
+	remove(csv.c_str());
+	remove(bin.c_str());
+}
+
+TEST(GzipInputReader, sameLinesAsFileInputReader)
+{
+	string path{"/tmp/MarketDataMergerGzipTest.csv"};
+	string gzPath = path + ".gz";
+	string content = "time,symbol,bid,bid_size,ask,ask_size\n";
+	for(int i=0;i<200;i++)
+		content += TimePoint::fromNanos(int64_t(i) * 1000000).toString() + ",SYM" + to_string(i % 7) + ",205.24," + to_string(i) + ",205.25,406\n";
+	content += "09:00:00.008,SPY,205.24,400,205.25,1306";	// no trailing newline
+	{
+		ofstream out(path);
+		out << content;
+		gzFile gz = gzopen(gzPath.c_str(), "wb");
+		ASSERT_EQ(int(content.size()), gzwrite(gz, content.data(), content.size()));
+		gzclose(gz);
+	}
+
+	// blocks smaller than a line as well
+	for(size_t blockSize : {size_t(7), size_t(64), size_t(1) << 20})
+	{
+		FileInputReader fileReader{path};
+		GzipInputReader gzReader{gzPath, blockSize, 2};
+		string expected;
+		string_view line;
+		while(fileReader.readLine(expected))
+		{
+			ASSERT_EQ(true, gzReader.readLineView(line));
+			ASSERT_EQ(expected, line);
+		}
+		ASSERT_EQ(false, gzReader.readLineView(line));
+		ASSERT_EQ(false, gzReader.isValid());
+		ASSERT_EQ(201, gzReader.numOfEntriesRead());
+	}
+
+	// stops the inflater when dropped half way
+	{
+		GzipInputReader gzReader{gzPath, 16, 2};
+		string_view line;
+		ASSERT_EQ(true, gzReader.readLineView(line));
+	}
+	// through the lazy reader, which lets go of a reader once it is invalid
+	Feed fileFeed(InputReaderPtr(new FileInputReader(path)), 0);
+	Feed gzFeed(InputReaderPtr(new LazyInputReader([gzPath]{return InputReaderPtr(new GzipInputReader(gzPath, 64, 2));})), 0);
+	int count = 0;
+	while(fileFeed.readNextValidRecordToCache())
+	{
+		ASSERT_EQ(true, gzFeed.readNextValidRecordToCache());
+		ASSERT_EQ(fileFeed.cache()->toString(), gzFeed.cache()->toString());
+		RecordPool::release(fileFeed.cache());
+		RecordPool::release(gzFeed.cache());
+		++count;
+	}
+	ASSERT_EQ(201, count);
+	ASSERT_EQ(false, gzFeed.readNextValidRecordToCache());
+
+	GzipInputReader missing{"/tmp/MarketDataMergerNoSuchFile.gz"};
+	ASSERT_EQ(false, missing.isValid());
+	remove(path.c_str());
+	remove(gzPath.c_str());
+}
+
+TEST(TopOfBookSink, sameTextAsToString)
+{
+	// every decimal, trailing zeros and point dropped
+	auto exact = [](Price price) {
+		stringstream ss;
+		ss << fixed << setprecision(PriceDecimals) << priceToDouble(price);
+		string text = ss.str();
+		text.erase(text.find_last_not_of('0') + 1);
+		if(text.back() == '.')
+			text.pop_back();
+		return text;
+	};
+	char buff[64];
+	std::mt19937_64 rng(11);
+	for(int i=0;i<10000;i++)
+	{
+		Price price = int64_t(rng() % 100000000) - (i % 10 == 0 ? 50000000 : 0);
+		ASSERT_EQ(exact(price), string(buff, TextFormat::appendPrice(buff, price)));
+
+		uint64_t value = rng() >> (rng() % 64);
+		ASSERT_EQ(to_string(value), string(buff, TextFormat::appendUnsigned(buff, value)));
+
+		TimePoint time = TimePoint::fromNanos(rng() % (24 * TimePoint::NanosPerHour) / (i % 3 == 0 ? 1 : i % 3 == 1 ? 1000 : 1000000) * (i % 3 == 0 ? 1 : i % 3 == 1 ? 1000 : 1000000));
+		ASSERT_EQ(time.toString(), string(buff, TextFormat::appendTime(buff, time)));
+	}
+
+	string path{"/tmp/MarketDataMergerSinkTest.csv"};
+	vector<CompositeBook::CompositeTopLevel> tops{
+		{SymbolTable::instance().intern("SPY"), Side(priceFromDouble(205.24), 1138), Side(priceFromDouble(205.25), 406), TimePoint("09:00:00.007")},
+		{SymbolTable::instance().intern("EEM"), Side(priceFromDouble(39.2), 49524), Side(priceFromDouble(39.21), 7413), TimePoint("09:00:00.008123")},
+		{SymbolTable::instance().intern("IWM"), Side(priceFromDouble(117), 0), Side(priceFromDouble(117.0001), 4294967295u), TimePoint("23:59:59.999999999")}};
+	string expected;
+	{
+		// a buffer smaller than the stream
+		TopOfBookSink sink(path, 256);
+		for(int i=0;i<100;i++)
+			for(const auto& top : tops)
+			{
+				sink.write(top);
+				expected += top.LastUpdate().toString() + "," + top.Symbol() + "," + exact(top.Bid().price()) + "," + to_string(top.Bid().qty()) + ","
+							+ exact(top.Ask().price()) + "," + to_string(top.Ask().qty()) + "\n";
+			}
+	}
+	ifstream in(path);
+	string written((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	ASSERT_EQ(expected, written);
+	// toString rounds to 6 digits
+	ASSERT_EQ(tops[0].toString() + "\n", written.substr(0, written.find('\n') + 1));
+	remove(path.c_str());
+
+	ASSERT_THROW(TopOfBookSink("/nonexistent/dir/out.csv"), invalid_argument);
+}
+
+TEST(Logger, formatsEveryThreadsEntriesInItsOrder)
+{
+	auto readLines = [](const string& path) {
+		ifstream in(path);
+		vector<string> lines;
+		for(string line;getline(in, line);)
+			lines.push_back(line);
+		return lines;
+	};
+	string path{"/tmp/MarketDataMergerLoggerTest.log"};
+	{
+		Logger logger(path);
+		MDM_LOG(logger, Logger::Level::Debug, "below the level {}", 1);
+		vector<thread> threads;
+		for(int t=0;t<3;t++)
+			threads.emplace_back([&logger, t]{
+				for(int i=0;i<50;i++)
+					MDM_LOG(logger, Logger::Level::Info, "thread {} entry {} of {} at {}", t, i, string("fifty"), -0.5);
+			});
+		for(auto& thread : threads)
+			thread.join();
+		MDM_LOG(logger, Logger::Level::Warning, "{} cut", string(1000, 'x'));
+		logger("plain");
+	}
+	vector<string> lines = readLines(path);
+	ASSERT_EQ(152, lines.size());
+	double last[3] = {0, 0, 0};
+	int next[3] = {0, 0, 0};
+	for(size_t i=0;i<150;i++)
+	{
+		ASSERT_NE(string::npos, lines[i].find(" INFO thread "));
+		int t = stoi(lines[i].substr(lines[i].find("thread ") + 7));
+		double seconds = stod(lines[i]);
+		ASSERT_LE(last[t], seconds);
+		last[t] = seconds;
+		ASSERT_NE(string::npos, lines[i].find("thread " + to_string(t) + " entry " + to_string(next[t]++) + " of fifty at -0.5"));
+	}
+	ASSERT_NE(string::npos, lines[150].find(" WARN xxxx"));
+	ASSERT_GT(Logger::EntrySize, lines[150].size());
+	ASSERT_NE(string::npos, lines[151].find(" INFO plain"));
+
+	// a full ring drops, it never waits
+	size_t dropped;
+	{
+		Logger logger(path, Logger::Level::Info, 4);
+		for(int i=0;i<1000;i++)
+			MDM_LOG(logger, Logger::Level::Info, "entry {}", i);
+		dropped = logger.droppedCount();
+	}
+	// every idle pass reports the drops since the last one
+	size_t entries = 0, reported = 0;
+	const string report{"log entries dropped, rings full: "};
+	for(const string& line : readLines(path))
+	{
+		if(line.compare(0, report.size(), report) == 0)
+			reported += stoul(line.substr(report.size()));
+		else
+			++entries;
+	}
+	ASSERT_LT(0u, dropped);
+	ASSERT_EQ(dropped, reported);
+	ASSERT_EQ(1000 - dropped, entries);
+}
+
+TEST(SymbolTable, denseIds)
+{
+	SymbolTable table;
+	ASSERT_EQ(0, table.intern("SPY"));
+	ASSERT_EQ(1, table.intern("QQQ"));
+	ASSERT_EQ(0, table.intern(string_view("SPY,205.24").substr(0, 3)));
+	ASSERT_EQ(2, table.size());
+	ASSERT_EQ("QQQ", table.name(1));
+
+	SymbolCache cache{table};
+	{
+		string line{"IWM"};
+		ASSERT_EQ(2, cache.lookup(line));
+	}
+	ASSERT_EQ(2, cache.lookup("IWM"));
+	ASSERT_EQ(1, cache.lookup("QQQ"));
+	ASSERT_EQ(3, table.size());
+}
+
 TEST(TimePoint, time)
 {
 	TimePoint tp1("09:00:00.007");
@@ -174,6 +664,17 @@ TEST(TimePoint, time)
 
 	ASSERT_EQ(true, tp3 == tp2);
 
+	// parsing is done at compile time
+	static_assert(TimePoint::parse("09:00:00.007") == 9*TimePoint::NanosPerHour + 7000000, "millisecond time");
+	static_assert(TimePoint::parse("23:59:59.123456789") == 86399*TimePoint::NanosPerSecond + 123456789, "nanosecond time");
+	static_assert(TimePoint::parse("10:00:01") == 36001*TimePoint::NanosPerSecond, "no fraction");
+	static_assert(TimePoint::parse("10:00:01.") == TimePoint::Invalid, "missing fraction");
+	static_assert(TimePoint::parse("1O:00:01.000") == TimePoint::Invalid, "not a digit");
+	static_assert(TimePoint::parse("10-00:01.000") == TimePoint::Invalid, "separator");
+
+	ASSERT_EQ("09:00:00.007", tp1.toString());
+	ASSERT_EQ("23:59:59.123456", TimePoint("23:59:59.123456").toString());
+	ASSERT_EQ(false, TimePoint().isValid());
 }
 
 TEST(ConsolidatedFeed, sortByTimeStamp)
@@ -223,146 +724,600 @@ TEST(ConsolidatedFeed, sortByTimeStamp)
 	while(record = cfeed.nextRecord())
 	{
 		recordCount++;
-		ASSERT_EQ(true, prevTime < record->Time());
+		ASSERT_EQ(true, prevTime <= record->Time());
 		prevTime = record->Time();
 	}
 
 	ASSERT_EQ(inputA.size()+inputB.size()+inputC.size(), recordCount);
 }
 
+// (time, feed, seq) sorted gives the expected merge order: ties go to the lower feed
+using ExpectedMerge = vector<tuple<int64_t, int, int>>;
+
+vector<FeedPtr> randomFeeds(int feedCount, ExpectedMerge& expected)
+{
+	std::mt19937 rng(7);
+	vector<FeedPtr> feeds;
+	for(int f=0;f<feedCount;f++)
+	{
+		vector<string> lines;
+		int64_t millis = 9*3600*1000;
+		int count = rng() % 50;
+		for(int i=0;i<count;i++)
+		{
+			millis += rng() % 3;
+			TimePoint tp = TimePoint::fromNanos(millis*1000000);
+			lines.push_back(tp.toString() + ",SPY,205.24," + to_string(i) + ",205.25,100");
+			expected.emplace_back(tp.nanos(), f, i);
+			if(rng() % 10 == 0)
+				lines.push_back("garbage line");
+		}
+		feeds.push_back(FeedPtr(new Feed(InputReaderPtr(new MockInputReader{lines}), f)));
+	}
+	sort(expected.begin(), expected.end());
+	return feeds;
+}
+
+void assertMergeOrder(ConsolidatedFeed& cfeed, const ExpectedMerge& expected)
+{
+	size_t n = 0;
+	while(RecordPtr record = cfeed.nextRecord())
+	{
+		ASSERT_LT(n, expected.size());
+		ASSERT_EQ(get<0>(expected[n]), record->Time().nanos());
+		ASSERT_EQ(get<1>(expected[n]), record->Feedid());
+		ASSERT_EQ(get<2>(expected[n]), record->BidSize());
+		RecordPool::release(record);
+		n++;
+	}
+	ASSERT_EQ(expected.size(), n);
+}
+
+TEST(ConsolidatedFeed, matchesStableSortAcrossManyFeeds)
+{
+	ExpectedMerge expected;
+	ConsolidatedFeed cfeed;
+	for(const FeedPtr& feed : randomFeeds(37, expected))
+		cfeed.addFeed(feed);
+	assertMergeOrder(cfeed, expected);
+}
+
+TEST(ConsolidatedFeed, readAheadKeepsMergeOrder)
+{
+	ExpectedMerge expected;
+	ConsolidatedFeed cfeed;
+	// small buffers so the readers keep running into full buffers
+	FeedReaderPool readers(3, 4);
+	for(const FeedPtr& feed : randomFeeds(37, expected))
+	{
+		readers.addFeed(feed);
+		cfeed.addFeed(feed);
+	}
+	readers.start();
+	assertMergeOrder(cfeed, expected);
+	readers.join();
+}
+
+TEST(RecordPool, noAllocationInSteadyState)
+{
+	RecordPool& pool = RecordPool::instance();
+	// bounded, so how far the producer runs ahead does not depend on the thread timing
+	SPSCRingBuffer<RecordPtr> toConsumer(1024);
+	auto produce = [&toConsumer](int count){
+		for(int i=0;i<count;i++)
+			toConsumer.push(RecordPool::create("09:00:00.007", "SPY", 2052400, 100, 2052500, 200, 0));
+		toConsumer.push(nullptr);
+	};
+	// records are released on another thread, as the book processors do
+	auto consume = [&toConsumer]{
+		RecordPtr rec{nullptr};
+		while(toConsumer.pop(rec) && rec)
+		{
+			ASSERT_EQ(100, rec->BidSize());
+			RecordPool::release(rec);
+		}
+	};
+
+	{
+		thread consumer(consume);
+		produce(3*RecordPool::SlabSize);
+		consumer.join();
+	}
+	size_t warmedUp = pool.capacity();
+	for(int round=0;round<5;round++)
+	{
+		thread consumer(consume);
+		produce(3*RecordPool::SlabSize);
+		consumer.join();
+	}
+	ASSERT_EQ(warmedUp, pool.capacity());
+}
+
+TEST(Partitioner, heavySymbolsGetTheirOwnProcessors)
+{
+	SymbolRates rates;
+	SymbolTable& table = SymbolTable::instance();
+	SymbolID spy = table.intern("SPY"), qqq = table.intern("QQQ");
+	rates[spy] = 500;
+	rates[qqq] = 300;
+	vector<SymbolID> tail;
+	for(int i=0;i<20;i++)
+	{
+		tail.push_back(table.intern("TAIL" + to_string(i)));
+		rates[tail.back()] = 1 + i % 4;
+	}
+
+	SymbolPartition partition = LoadAwarePartitioner().partition(rates, 4);
+	ASSERT_EQ(0, partition.processorOf(spy));
+	ASSERT_EQ(1, partition.processorOf(qqq));
+	for(SymbolID symbol : tail)
+		ASSERT_LE(2, partition.processorOf(symbol));
+	// symbols without a rate stay off the dedicated processors
+	ASSERT_LE(2, partition.processorOf(table.intern("UNSEEN")));
+
+	const vector<double>& load = partition.plannedLoad();
+	ASSERT_EQ(500, load[0]);
+	ASSERT_EQ(300, load[1]);
+	ASSERT_EQ(50, load[2] + load[3]);
+	ASSERT_GE(4, abs(load[2] - load[3]));
+
+	// bad rates files are rejected with a message main reports
+	ASSERT_THROW(readSymbolRates("/nonexistent/rates"), invalid_argument);
+	string path{"/tmp/MarketDataMergerRatesTest.csv"};
+	for(string rate : {"1e999", "fast"})
+	{
+		ofstream(path) << "SPY,500\nQQQ," << rate << "\n";
+		ASSERT_THROW(readSymbolRates(path), invalid_argument);
+	}
+}
+
+TEST(Config, threadLayout)
+{
+	const char* argv[] = {"mdm", "--processors", "3", "--cpu-processors", "2-3,6", "--cpu-mux", "1", "--rt-priority", "10", "feed_a"};
+	Config config = Config::fromCommandLine(sizeof(argv)/sizeof(argv[0]), const_cast<char**>(argv));
+	ASSERT_EQ(3, config.processors);
+	ASSERT_EQ(vector<int>({2, 3, 6}), config.threads.processorCpus);
+	ASSERT_EQ(6, config.threads.processor(2).cpu);
+	ASSERT_EQ(2, config.threads.processor(3).cpu);
+	ASSERT_EQ(10, config.threads.processor(0).priority);
+	ASSERT_EQ(1, config.threads.multiplexer().cpu);
+	ASSERT_EQ(-1, config.threads.feed().cpu);
+	ASSERT_EQ(0, config.threads.reporter().priority);
+	ASSERT_EQ(vector<string>({"feed_a"}), config.feeds);
+
+	const char* badList[] = {"mdm", "--cpu-readers", "5-2"};
+	ASSERT_THROW(Config::fromCommandLine(3, const_cast<char**>(badList)), invalid_argument);
+
+	// only a build for a fixed number of feeds has a limit worth checking
+	vector<const char*> many(FixedFeedCount ? MaxFeeds + 2 : 300, "feed_a");
+	if(FixedFeedCount)
+	{
+		ASSERT_THROW(Config::fromCommandLine(many.size(), const_cast<char**>(many.data())), invalid_argument);
+	}
+	else
+	{
+		ASSERT_EQ(many.size() - 1, Config::fromCommandLine(many.size(), const_cast<char**>(many.data())).feeds.size());
+	}
+}
+
+// afterPush is called after every record, e.g. to move symbols while the records are queued
+unordered_map<SymbolID, BookStatistics> consume(MarketDataConsumer::Routing routing,
+												const function<void(MarketDataConsumer&, int, SymbolID)>& afterPush = nullptr,
+												size_t* migrations = nullptr)
+{
+	ReporterPtr reporter{new StandardOutputReporter()};
+	MarketDataConsumer consumer(3, reporter, routing);
+	consumer.start();
+	std::mt19937 rng(7);
+	for(int i=0;i<2000;i++)
+	{
+		Price bid = 2052400 + 100*(rng() % 10);
+		SymbolID symbol = SymbolTable::instance().intern("SYM" + to_string(rng() % 10));
+		FeedID feed = rng() % 2;
+		consumer.push(RecordPool::create(TimePoint::fromNanos(i), SymbolTable::instance().name(symbol), bid, 100, bid + 100, 100, feed));
+		if(afterPush)
+			afterPush(consumer, i, symbol);
+	}
+	consumer.push(nullptr);
+	consumer.join();
+	reporter->requestStop();
+	if(migrations)
+		*migrations = consumer.migrationCount();
+	return consumer.getBookStatistics();
+}
+
+TEST(MarketDataConsumer, directRoutingBuildsTheSameBooks)
+{
+	unordered_map<SymbolID, BookStatistics> multiplexed = consume(MarketDataConsumer::Routing::Multiplexed);
+	unordered_map<SymbolID, BookStatistics> direct = consume(MarketDataConsumer::Routing::Direct);
+	ASSERT_EQ(10, multiplexed.size());
+	ASSERT_EQ(multiplexed.size(), direct.size());
+	for(const auto& p : multiplexed)
+	{
+		const BookStatistics& other = direct.at(p.first);
+		ASSERT_EQ(p.second.UpdateCount(), other.UpdateCount());
+		ASSERT_EQ(p.second.MinBid(), other.MinBid());
+		ASSERT_EQ(p.second.MaxAsk(), other.MaxAsk());
+	}
+}
+
+TEST(MarketDataConsumer, migrationKeepsTheBooks)
+{
+	for(auto routing : {MarketDataConsumer::Routing::Direct, MarketDataConsumer::Routing::Multiplexed})
+	{
+		unordered_map<SymbolID, BookStatistics> expected = consume(routing);
+		size_t migrations = 0;
+		unordered_map<SymbolID, BookStatistics> migrated = consume(routing, [](MarketDataConsumer& consumer, int i, SymbolID symbol){
+			// keep moving the symbols around while their records are queued
+			if(i % 50 == 0)
+				consumer.requestMigration(symbol, i % 3);
+			if(i % 70 == 0)
+				consumer.requestRebalance(i % 3, (i+1) % 3);
+		}, &migrations);
+		if(routing == MarketDataConsumer::Routing::Direct)
+		{
+			ASSERT_LT(10, migrations);
+		}
+
+		ASSERT_EQ(expected.size(), migrated.size());
+		for(const auto& p : expected)
+		{
+			const BookStatistics& other = migrated.at(p.first);
+			ASSERT_EQ(p.second.MessageCount(), other.MessageCount());
+			ASSERT_EQ(p.second.UpdateCount(), other.UpdateCount());
+			ASSERT_EQ(p.second.MinBid(), other.MinBid());
+			ASSERT_EQ(p.second.MaxAsk(), other.MaxAsk());
+		}
+	}
+}
+
+TEST(Rebalancer, movesLoadOnlyWhenOverloadedForAWhile)
+{
+	Rebalancer rebalancer(3, 1024, [](int){return Rebalancer::Sample{0, 0};}, [](int, int){});
+	int from = -1, to = -1;
+	// balanced, or lopsided but mostly idle
+	ASSERT_FALSE(rebalancer.observe({0.9, 0.8, 0.85}, from, to));
+	ASSERT_FALSE(rebalancer.observe({0.3, 0.01, 0.05}, from, to));
+	for(int i=1;i<Rebalancer::Persistence;i++)
+		ASSERT_FALSE(rebalancer.observe({0.2, 0.95, 0.3}, from, to));
+	ASSERT_TRUE(rebalancer.observe({0.2, 0.95, 0.3}, from, to));
+	ASSERT_EQ(1, from);
+	ASSERT_EQ(0, to);
+	// a calm period starts the count again
+	ASSERT_FALSE(rebalancer.observe({0.2, 0.95, 0.3}, from, to));
+	ASSERT_FALSE(rebalancer.observe({0.5, 0.5, 0.5}, from, to));
+	ASSERT_FALSE(rebalancer.observe({0.2, 0.95, 0.3}, from, to));
+}
+
+template<class Mask>
+void feedMaskAcrossWords()
+{
+	Mask mask;
+	ASSERT_TRUE(mask.none());
+	for(size_t i : {0, 63, 64, 129})
+		mask.set(i);
+	ASSERT_EQ(4, mask.count());
+	ASSERT_TRUE(mask.test(64));
+	mask.reset(64);
+	ASSERT_FALSE(mask.test(64));
+	vector<size_t> feeds;
+	mask.forEach([&feeds](size_t i){feeds.push_back(i);});
+	ASSERT_EQ(vector<size_t>({0, 63, 129}), feeds);
+	mask.only(5);
+	ASSERT_EQ(1, mask.count());
+	ASSERT_TRUE(mask.test(5));
+	ASSERT_FALSE(mask.test(129));
+}
+
+TEST(FeedMask, acrossWords)
+{
+	feedMaskAcrossWords<FeedMaskT<130>>();
+	feedMaskAcrossWords<DynamicFeedMask>();
+	// grows as feeds are set, anything past it is not set
+	DynamicFeedMask mask;
+	ASSERT_FALSE(mask.test(1000));
+	mask.set(1000);
+	ASSERT_TRUE(mask.test(1000));
+	ASSERT_EQ(1, mask.count());
+}
+
+TEST(LatencyHistogram, percentilesWithinPrecision)
+{
+	LatencyHistogram h(7);
+	ASSERT_EQ(0u, h.p99());
+	ASSERT_EQ(0u, h.min());
+
+	// exact below 2^7
+	for(uint64_t v=1;v<=100;v++)
+		h.record(v);
+	ASSERT_EQ(100u, h.count());
+	ASSERT_EQ(1u, h.min());
+	ASSERT_EQ(100u, h.max());
+	ASSERT_EQ(50u, h.p50());
+	ASSERT_EQ(90u, h.p90());
+	ASSERT_EQ(99u, h.p99());
+	ASSERT_DOUBLE_EQ(50.5, h.mean());
+
+	// above, within 1/64 of the value
+	std::mt19937_64 rng(7);
+	for(int i=0;i<10000;i++)
+	{
+		uint64_t v = rng() >> (rng() % 64);
+		LatencyHistogram one(7);
+		one.record(v);
+		one.record(v == 0 ? 0 : v-1);
+		uint64_t top = one.p999();
+		ASSERT_GE(top, v == 0 ? 0 : v-1);
+		ASSERT_LE(top - (v == 0 ? 0 : v-1), v / 64 + 1);
+	}
+
+	LatencyHistogram other(7);
+	for(uint64_t v=0;v<1000;v++)
+		other.record(100000 + v);
+	h.merge(other);
+	ASSERT_EQ(1100u, h.count());
+	ASSERT_EQ(100999u, h.max());
+	ASSERT_EQ(100u, h.percentile(100.0 / 11));
+	// the 550th value is 100449
+	ASSERT_GE(h.p50(), 100449u);
+	ASSERT_LE(h.p50(), 100449u + 100449 / 64);
+
+	LatencyHistogram coarse(3);
+	ASSERT_THROW(h.merge(coarse), invalid_argument);
+	ASSERT_THROW(LatencyHistogram(0), invalid_argument);
+}
+
+TEST(StageLatencies, skippedStagesCountIntoTheNext)
+{
+	TscClock::calibrate();
+	ASSERT_GT(TscClock::ticksPerNano(), 0.0);
+	TscClock::Ticks before = TscClock::now();
+	std::this_thread::sleep_for(chrono::milliseconds(2));
+	uint64_t slept = TscClock::nanosBetween(before, TscClock::now());
+	ASSERT_GE(slept, 1500000u);
+	ASSERT_LT(slept, 1000000000u);
+	ASSERT_EQ(0u, TscClock::nanosBetween(TscClock::now(), before));
+
+	// direct routing, no Routed stamp
+	auto ticks = [](uint64_t nanos) {return TscClock::Ticks(1000000 + nanos * TscClock::ticksPerNano());};
+	StageStamps stamps;
+	stamps.stamp(Stage::Read, ticks(0));
+	stamps.stamp(Stage::Parsed, ticks(1000));
+	stamps.stamp(Stage::Merged, ticks(3000));
+	stamps.stamp(Stage::Dequeued, ticks(7000));
+	stamps.stamp(Stage::Applied, ticks(8000));
+	StageLatencies latencies;
+	latencies.record(stamps);
+	auto near = [](uint64_t value, uint64_t expected) {return value + 20 >= expected && value <= expected + expected / 64 + 20;};
+	ASSERT_TRUE(near(latencies.interval(0).max(), 1000));
+	ASSERT_TRUE(near(latencies.interval(1).max(), 2000));
+	ASSERT_EQ(0u, latencies.interval(2).count());
+	ASSERT_TRUE(near(latencies.interval(3).max(), 4000));
+	ASSERT_TRUE(near(latencies.interval(4).max(), 1000));
+	ASSERT_TRUE(near(latencies.total().max(), 8000));
+	ASSERT_STREQ("processorQueue", StageLatencies::intervalName(3));
+
+	Record rec("10:00:00.000", "SPY", priceFromDouble(205.12), 500, priceFromDouble(205.13), 200, 0);
+	ASSERT_NE(0u, rec.Stamps().at(Stage::Read));
+	ASSERT_EQ(0u, rec.Stamps().at(Stage::Applied));
+
+	StageLatencies all;
+	all.merge(latencies);
+	all.merge(latencies);
+	ASSERT_EQ(2u, all.total().count());
+	ASSERT_EQ(0u, all.interval(2).count());
+}
+
+TEST(TopLevel, matchesScanOverAllFeeds)
+{
+	std::mt19937 rng(11);
+	for(size_t feeds : {size_t(2), size_t(5), min<size_t>(MaxFeeds, 200)})
+	{
+		TopLevel top;
+		vector<Side> bids(feeds), asks(feeds);
+		vector<bool> quoted(feeds, false);
+		for(int i=0;i<20000;i++)
+		{
+			// few price levels, so feeds often tie and the best often empties
+			FeedID feed = rng() % feeds;
+			bids[feed] = Side(100 + rng() % 4, 1 + rng() % 9);
+			asks[feed] = Side(104 + rng() % 4, 1 + rng() % 9);
+			quoted[feed] = true;
+			top.update(feed, bids[feed], SideEnum::Bid);
+			top.update(feed, asks[feed], SideEnum::Ask);
+
+			Side bestBid, bestAsk;
+			unsigned bidCount = 0, askCount = 0;
+			for(size_t f=0;f<feeds;f++)
+			{
+				if(!quoted[f])
+					continue;
+				if(bidCount == 0 || bids[f].price() > bestBid.price())
+				{
+					bestBid = bids[f];
+					bidCount = 1;
+				}
+				else if(bids[f].price() == bestBid.price())
+				{
+					bestBid.update(bestBid.price(), bestBid.qty() + bids[f].qty());
+					bidCount++;
+				}
+				if(askCount == 0 || asks[f].price() < bestAsk.price())
+				{
+					bestAsk = asks[f];
+					askCount = 1;
+				}
+				else if(asks[f].price() == bestAsk.price())
+				{
+					bestAsk.update(bestAsk.price(), bestAsk.qty() + asks[f].qty());
+					askCount++;
+				}
+			}
+			ASSERT_EQ(bestBid, top.Bid());
+			ASSERT_EQ(bestAsk, top.Ask());
+			ASSERT_EQ(bidCount, top.BidCount());
+			ASSERT_EQ(askCount, top.AskCount());
+			ASSERT_TRUE(top.feedInvolved(feed, SideEnum::Bid) == (bids[feed].price() == bestBid.price()));
+		}
+	}
+}
+
+// feeds showing up in id order grow the tree a level at a time
+TEST(TopLevel, keepsEarlierFeedsWhenTheTreeGrows)
+{
+	TopLevel top;
+	top.update(0, Side(99, 5), SideEnum::Bid);
+	top.update(0, Side(98, 5), SideEnum::Bid);
+	top.update(2, Side(200, 5), SideEnum::Bid);
+	top.update(2, Side(50, 5), SideEnum::Bid);
+	ASSERT_EQ(Side(98, 5), top.Bid());
+
+	TopLevel growing;
+	for(FeedID feed=0;size_t(feed)<min<size_t>(MaxFeeds, 1024);feed++)
+	{
+		// takes the lead and gives it back, so the best comes out of the tree
+		growing.update(feed, Side(2000, 1), SideEnum::Bid);
+		growing.update(feed, Side(500 - feed, 1), SideEnum::Bid);
+		ASSERT_EQ(Side(500, 1), growing.Bid());
+		ASSERT_EQ(1, growing.BidCount());
+	}
+}
+
 Tokenizer tokenizer(',');
 
+Price px(double p) {return priceFromDouble(p);}
+
 TEST(CompositeBook, noCross)
 {
 	string symbol{"SPY"};
-	CompositeBook cbook{symbol};
+	CompositeBook cbook{SymbolTable::instance().intern(symbol)};
 	CompositeTopLevel top;
 	FeedID idA = 0;
 	FeedID idB = 1;
 	FeedID idC = 2;
 
-	vector<Record> records{	Record("10:00:00.000", symbol, 205.12, 500, 205.13, 200, idA),
-							Record("10:00:00.001", symbol, 205.12, 600, 205.14, 200, idB),
-							Record("10:00:00.001", symbol, 205.11, 300, 205.14, 200, idC),			//should not change top
-							Record("10:00:00.001", symbol, 205.11, 320, 205.14, 200, idB),			//should change top as idB pulls out from the best level total qty
-							Record("10:00:00.002", symbol, 205.10, 200, 205.13, 200, idA),			// should change top of bid to the above for idB and idC becomes best
-							Record("10:00:00.002", symbol, 205.09, 200, 205.13, 200, idA),			// should not change
-							Record("10:00:00.003", symbol, 205.09, 400, 205.13, 200, idC),			// should change
-							Record("10:00:00.003", symbol, 205.09, 400, 205.14, 1200, idA),
-							Record("10:00:00.004", symbol, 205.09, 250, 205.15, 600, idC),
-							Record("10:00:00.005", symbol, 205.10, 120, 205.13, 70, idB),
-							Record("10:00:00.005", symbol, 205.08, 220, 205.15, 90, idB),
-							Record("10:00:00.005", symbol, 205.08, 120, 205.13, 40, idA),
-							Record("10:00:00.005", symbol, 205.11, 20, 205.15, 70, idA),
-							Record("10:00:00.005", symbol, 205.09, 60, 205.16, 40, idA),
-							Record("10:00:00.005", symbol, 205.08, 240, 205.15, 90, idB),
-							Record("10:00:00.004", symbol, 205.10, 150, 205.16, 400, idC),
-							Record("10:00:00.004", symbol, 205.10, 150, 205.16, 450, idC),
-							Record("10:00:00.005", symbol, 205.10, 140, 205.13, 60, idB)
+	vector<Record> records{	Record("10:00:00.000", symbol, px(205.12), 500, px(205.13), 200, idA),
+							Record("10:00:00.001", symbol, px(205.12), 600, px(205.14), 200, idB),
+							Record("10:00:00.001", symbol, px(205.11), 300, px(205.14), 200, idC),			//should not change top
+							Record("10:00:00.001", symbol, px(205.11), 320, px(205.14), 200, idB),			//should change top as idB pulls out from the best level total qty
+							Record("10:00:00.002", symbol, px(205.10), 200, px(205.13), 200, idA),			// should change top of bid to the above for idB and idC becomes best
+							Record("10:00:00.002", symbol, px(205.09), 200, px(205.13), 200, idA),			// should not change
+							Record("10:00:00.003", symbol, px(205.09), 400, px(205.13), 200, idC),			// should change
+							Record("10:00:00.003", symbol, px(205.09), 400, px(205.14), 1200, idA),
+							Record("10:00:00.004", symbol, px(205.09), 250, px(205.15), 600, idC),
+							Record("10:00:00.005", symbol, px(205.10), 120, px(205.13), 70, idB),
+							Record("10:00:00.005", symbol, px(205.08), 220, px(205.15), 90, idB),
+							Record("10:00:00.005", symbol, px(205.08), 120, px(205.13), 40, idA),
+							Record("10:00:00.005", symbol, px(205.11), 20, px(205.15), 70, idA),
+							Record("10:00:00.005", symbol, px(205.09), 60, px(205.16), 40, idA),
+							Record("10:00:00.005", symbol, px(205.08), 240, px(205.15), 90, idB),
+							Record("10:00:00.004", symbol, px(205.10), 150, px(205.16), 400, idC),
+							Record("10:00:00.004", symbol, px(205.10), 150, px(205.16), 450, idC),
+							Record("10:00:00.005", symbol, px(205.10), 140, px(205.13), 60, idB)
 						  };
 
 	ASSERT_EQ(true, cbook.update(records[0]));	// first entry
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.12, 500), top.Bid());
-	ASSERT_EQ(Side(205.13, 200), top.Ask());
+	ASSERT_EQ(Side(px(205.12), 500), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 200), top.Ask());
 
 
 	ASSERT_EQ(true, cbook.update(records[1]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.12, 1100), top.Bid());
-	ASSERT_EQ(Side(205.13, 200),  top.Ask());
+	ASSERT_EQ(Side(px(205.12), 1100), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 200),  top.Ask());
 
 
 	ASSERT_EQ(false, cbook.update(records[2]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.12, 1100), top.Bid());
-	ASSERT_EQ(Side(205.13, 200),  top.Ask());
+	ASSERT_EQ(Side(px(205.12), 1100), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 200),  top.Ask());
 
 	ASSERT_EQ(true, cbook.update(records[3]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.12, 500), top.Bid());
-	ASSERT_EQ(Side(205.13, 200),  top.Ask());
+	ASSERT_EQ(Side(px(205.12), 500), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 200),  top.Ask());
 
 	ASSERT_EQ(true, cbook.update(records[4]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.11, 620), top.Bid());
-	ASSERT_EQ(Side(205.13, 200),  top.Ask());
+	ASSERT_EQ(Side(px(205.11), 620), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 200),  top.Ask());
 
 	ASSERT_EQ(false, cbook.update(records[5]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.11, 620), top.Bid());
-	ASSERT_EQ(Side(205.13, 200),  top.Ask());
+	ASSERT_EQ(Side(px(205.11), 620), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 200),  top.Ask());
 
 
 	ASSERT_EQ(true, cbook.update(records[6]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.11, 320), top.Bid());
-	ASSERT_EQ(Side(205.13, 400),  top.Ask());
+	ASSERT_EQ(Side(px(205.11), 320), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 400),  top.Ask());
 
 
 	ASSERT_EQ(true, cbook.update(records[7]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.11, 320), top.Bid());
-	ASSERT_EQ(Side(205.13, 200),  top.Ask());
+	ASSERT_EQ(Side(px(205.11), 320), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 200),  top.Ask());
 
 
 	ASSERT_EQ(true, cbook.update(records[8]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.11, 320), top.Bid());
-	ASSERT_EQ(Side(205.14, 1400),  top.Ask());
+	ASSERT_EQ(Side(px(205.11), 320), top.Bid());
+	ASSERT_EQ(Side(px(205.14), 1400),  top.Ask());
 
 
 	ASSERT_EQ(true, cbook.update(records[9]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.10, 120), top.Bid());
-	ASSERT_EQ(Side(205.13, 70),  top.Ask());
+	ASSERT_EQ(Side(px(205.10), 120), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 70),  top.Ask());
 
 
 	ASSERT_EQ(true, cbook.update(records[10]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.09, 650), top.Bid());
-	ASSERT_EQ(Side(205.14, 1200),  top.Ask());
+	ASSERT_EQ(Side(px(205.09), 650), top.Bid());
+	ASSERT_EQ(Side(px(205.14), 1200),  top.Ask());
 
 
 	ASSERT_EQ(true, cbook.update(records[11]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.09, 250), top.Bid());
-	ASSERT_EQ(Side(205.13, 40),  top.Ask());
+	ASSERT_EQ(Side(px(205.09), 250), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 40),  top.Ask());
 
 
 	ASSERT_EQ(true, cbook.update(records[12]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.11, 20), top.Bid());
-	ASSERT_EQ(Side(205.15, 760),  top.Ask());
+	ASSERT_EQ(Side(px(205.11), 20), top.Bid());
+	ASSERT_EQ(Side(px(205.15), 760),  top.Ask());
 
 
 	ASSERT_EQ(true, cbook.update(records[13]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.09, 310), top.Bid());
-	ASSERT_EQ(Side(205.15, 690),  top.Ask());
+	ASSERT_EQ(Side(px(205.09), 310), top.Bid());
+	ASSERT_EQ(Side(px(205.15), 690),  top.Ask());
 
 
 	ASSERT_EQ(false, cbook.update(records[14]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.09, 310), top.Bid());
-	ASSERT_EQ(Side(205.15, 690),  top.Ask());
+	ASSERT_EQ(Side(px(205.09), 310), top.Bid());
+	ASSERT_EQ(Side(px(205.15), 690),  top.Ask());
 
 
 	ASSERT_EQ(true, cbook.update(records[15]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.10, 150), top.Bid());
-	ASSERT_EQ(Side(205.15, 90),  top.Ask());
+	ASSERT_EQ(Side(px(205.10), 150), top.Bid());
+	ASSERT_EQ(Side(px(205.15), 90),  top.Ask());
 
 	ASSERT_EQ(false, cbook.update(records[16]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.10, 150), top.Bid());
-	ASSERT_EQ(Side(205.15, 90),  top.Ask());
+	ASSERT_EQ(Side(px(205.10), 150), top.Bid());
+	ASSERT_EQ(Side(px(205.15), 90),  top.Ask());
 
 
 	ASSERT_EQ(true, cbook.update(records[17]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.10, 290), top.Bid());
-	ASSERT_EQ(Side(205.13, 60),  top.Ask());
+	ASSERT_EQ(Side(px(205.10), 290), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 60),  top.Ask());
 
 }
 
@@ -370,15 +1325,15 @@ TEST(CompositeBook, noCross)
 TEST(CompositeBook, arbitrage)
 {
 	string symbol{"SPY"};
-	CompositeBook cbook{symbol};
+	CompositeBook cbook{SymbolTable::instance().intern(symbol)};
 	CompositeTopLevel top;
 	FeedID idA = 0;
 	FeedID idB = 1;
 	FeedID idC = 2;
 
-	vector<Record> records{	Record("10:00:00.000", symbol, 205.09, 60, 205.16, 40, idA),
-							Record("10:00:00.001", symbol, 205.10, 140, 205.13, 60, idB),
-							Record("10:00:00.001", symbol, 205.10, 150, 205.16, 450, idC)
+	vector<Record> records{	Record("10:00:00.000", symbol, px(205.09), 60, px(205.16), 40, idA),
+							Record("10:00:00.001", symbol, px(205.10), 140, px(205.13), 60, idB),
+							Record("10:00:00.001", symbol, px(205.10), 150, px(205.16), 450, idC)
 						  };
 
 	cbook.update(records[0]);
@@ -386,48 +1341,48 @@ TEST(CompositeBook, arbitrage)
 	cbook.update(records[2]);
 
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.10, 290), top.Bid());
-	ASSERT_EQ(Side(205.13, 60), top.Ask());
+	ASSERT_EQ(Side(px(205.10), 290), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 60), top.Ask());
 
 	// let's do some arbitrage
-	records.push_back(Record("10:00:00.002", symbol, 205.13, 40, 205.15, 80, idC));
+	records.push_back(Record("10:00:00.002", symbol, px(205.13), 40, px(205.15), 80, idC));
 
 	ASSERT_EQ(true, cbook.update(records[3]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.13, 40), top.Bid());
-	ASSERT_EQ(Side(205.13, 60), top.Ask());
+	ASSERT_EQ(Side(px(205.13), 40), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 60), top.Ask());
 
-	records.push_back(Record("10:00:00.003", symbol, 205.14, 20, 205.15, 120, idC));
+	records.push_back(Record("10:00:00.003", symbol, px(205.14), 20, px(205.15), 120, idC));
 
 	ASSERT_EQ(true, cbook.update(records[4]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.14, 20), top.Bid());
-	ASSERT_EQ(Side(205.13, 60), top.Ask());
+	ASSERT_EQ(Side(px(205.14), 20), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 60), top.Ask());
 
-	records.push_back(Record("10:00:00.003", symbol, 205.14, 70, 205.15, 80, idA));
+	records.push_back(Record("10:00:00.003", symbol, px(205.14), 70, px(205.15), 80, idA));
 
 	ASSERT_EQ(true, cbook.update(records[5]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.14, 90), top.Bid());
-	ASSERT_EQ(Side(205.13, 60), top.Ask());
+	ASSERT_EQ(Side(px(205.14), 90), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 60), top.Ask());
 
-	records.push_back(Record("10:00:00.003", symbol, 205.14, 25, 205.16, 40, idB));
+	records.push_back(Record("10:00:00.003", symbol, px(205.14), 25, px(205.16), 40, idB));
 	ASSERT_EQ(true, cbook.update(records[6]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.14, 115), top.Bid());
-	ASSERT_EQ(Side(205.15, 200), top.Ask());
+	ASSERT_EQ(Side(px(205.14), 115), top.Bid());
+	ASSERT_EQ(Side(px(205.15), 200), top.Ask());
 
-	records.push_back(Record("10:00:00.004", symbol, 205.12, 10, 205.13, 70, idB));
+	records.push_back(Record("10:00:00.004", symbol, px(205.12), 10, px(205.13), 70, idB));
 	ASSERT_EQ(true, cbook.update(records[7]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.14, 90), top.Bid());
-	ASSERT_EQ(Side(205.13, 70), top.Ask());
+	ASSERT_EQ(Side(px(205.14), 90), top.Bid());
+	ASSERT_EQ(Side(px(205.13), 70), top.Ask());
 
-	records.push_back(Record("10:00:00.004", symbol, 205.13, 15, 205.16, 40, idB));
+	records.push_back(Record("10:00:00.004", symbol, px(205.13), 15, px(205.16), 40, idB));
 	ASSERT_EQ(true, cbook.update(records[8]));
 	top = cbook.getTopBook();
-	ASSERT_EQ(Side(205.14, 90), top.Bid());
-	ASSERT_EQ(Side(205.15, 200), top.Ask());
+	ASSERT_EQ(Side(px(205.14), 90), top.Bid());
+	ASSERT_EQ(Side(px(205.15), 200), top.Ask());
 
 
 }